@@ -0,0 +1,235 @@
+/**
+ *  @file    main.cpp
+ *  @brief   Lux Meter Serial Telemetry Logger
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *
+ ***********************************************/
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "../../src/RoundRobin.h"
+#include "../../src/Telemetry.h"
+
+// binary archive record
+struct __attribute__((packed)) Record {
+  uint64_t unix_ms;
+  uint16_t code; // see RoundRobin.h
+};
+
+static int fd = -1;
+
+speed_t baud_to_speed(long baud) {
+  switch (baud) {
+  case 9600:
+    return B9600;
+  case 57600:
+    return B57600;
+  case 115200:
+    return B115200;
+  case 230400:
+    return B230400;
+  }
+  return B0;
+}
+
+bool serial_open(const char *port, long baud) {
+  speed_t speed = baud_to_speed(baud);
+  if (speed == B0) {
+    std::fprintf(stderr, "unsupported baud rate %ld\n", baud);
+    return false;
+  }
+
+  fd = open(port, O_RDWR | O_NOCTTY);
+  if (fd < 0) {
+    std::fprintf(stderr, "failed to open '%s': %s\n", port,
+                 std::strerror(errno));
+    return false;
+  }
+
+  struct termios tio;
+  tcgetattr(fd, &tio);
+  cfmakeraw(&tio);
+  cfsetispeed(&tio, speed);
+  cfsetospeed(&tio, speed);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cflag &= ~CRTSCTS;
+  tio.c_cc[VMIN] = 1;
+  tio.c_cc[VTIME] = 0;
+  tcsetattr(fd, TCSANOW, &tio);
+  tcflush(fd, TCIOFLUSH);
+
+  return true;
+}
+
+// reads at least one byte into buf, blocking; false on end of stream
+bool serial_fill(std::vector<uint8_t> &buf) {
+  uint8_t data[256];
+  for (;;) {
+    ssize_t n = read(fd, data, sizeof(data));
+    if (n > 0) {
+      buf.insert(buf.end(), data, data + n);
+      return true;
+    }
+    if (n == 0 || (errno != EINTR && errno != EAGAIN))
+      return false;
+  }
+}
+
+uint64_t unix_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// extracts the next valid frame from buf, returning its total length, or 0
+// when more data is needed; anything that is not a valid frame, such as the
+// text output of the 'S' command, is dropped
+size_t next_frame(std::vector<uint8_t> &buf) {
+  size_t skip = 0;
+  for (;; ++skip) {
+    if (buf.size() - skip < 2)
+      break;
+    if (buf[skip] != TELEMETRY_SYNC0 || buf[skip + 1] != TELEMETRY_SYNC1)
+      continue;
+    if (buf.size() - skip < sizeof(struct TelemetryHeader))
+      break;
+    struct TelemetryHeader hdr;
+    std::memcpy(&hdr, &buf[skip], sizeof(hdr));
+    if (hdr.version != TELEMETRY_VERSION || hdr.count == 0 ||
+        hdr.count > TELEMETRY_BATCH_MAX)
+      continue;
+    const size_t len = sizeof(hdr) + hdr.count * sizeof(uint16_t);
+    if (buf.size() - skip < len + sizeof(uint16_t))
+      break;
+    uint16_t crc;
+    std::memcpy(&crc, &buf[skip + len], sizeof(crc));
+    if (telemetry_crc16(0, &buf[skip + 2], len - 2) != crc)
+      continue;
+    buf.erase(buf.begin(), buf.begin() + skip);
+    return len + sizeof(crc);
+  }
+  if (skip)
+    buf.erase(buf.begin(), buf.begin() + skip);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+
+  long baud = 115200;
+  const char *csv_path = nullptr, *bin_path = nullptr;
+  int opt;
+  while ((opt = getopt(argc, argv, "b:c:o:")) != -1) {
+    if (opt == 'b')
+      baud = std::atol(optarg);
+    else if (opt == 'c')
+      csv_path = optarg;
+    else if (opt == 'o')
+      bin_path = optarg;
+    else
+      break;
+  }
+
+  if (argc - optind < 1) {
+    std::fprintf(stderr,
+                 "usage: %s [-b baud] [-c archive.csv] [-o archive.bin] port\n",
+                 argv[0]);
+    return 1;
+  }
+
+  FILE *csv = nullptr, *bin = nullptr;
+  if (csv_path) {
+    csv = std::fopen(csv_path, "a");
+    if (!csv) {
+      std::fprintf(stderr, "failed to open '%s'\n", csv_path);
+      return 1;
+    }
+    if (std::ftell(csv) == 0)
+      std::fprintf(csv, "unix_ms,device_ms,lux\n");
+  } else if (!bin_path)
+    csv = stdout;
+  if (bin_path) {
+    bin = std::fopen(bin_path, "ab");
+    if (!bin) {
+      std::fprintf(stderr, "failed to open '%s'\n", bin_path);
+      return 1;
+    }
+  }
+
+  if (!serial_open(argv[optind], baud))
+    return 1;
+
+  std::vector<uint8_t> buf;
+  bool synced = false;
+  struct TelemetryHeader last;
+  unsigned long frames = 0, missed = 0, restarts = 0;
+
+  while (serial_fill(buf)) {
+    size_t len;
+    while ((len = next_frame(buf)) != 0) {
+      const uint64_t now = unix_ms();
+      struct TelemetryHeader hdr;
+      std::memcpy(&hdr, buf.data(), sizeof(hdr));
+      std::vector<uint16_t> codes(hdr.count);
+      std::memcpy(codes.data(), buf.data() + sizeof(hdr),
+                  hdr.count * sizeof(uint16_t));
+      buf.erase(buf.begin(), buf.begin() + len);
+
+      if (synced) {
+        // millis() wraps after ~49.7 days, so a timestamp going back only
+        // means a restart when the sequence breaks as well
+        const uint16_t expected = last.seq + 1;
+        if (hdr.seq != expected && hdr.timestamp < last.timestamp) {
+          ++restarts;
+          std::fprintf(stderr, "device restarted at seq %u\n", hdr.seq);
+        } else if (hdr.seq != expected) {
+          const uint16_t lost = hdr.seq - expected;
+          missed += (unsigned long)lost * hdr.count;
+          std::fprintf(stderr, "gap: %u frame(s), ~%lu sample(s) lost\n", lost,
+                       (unsigned long)lost * hdr.count);
+        }
+      }
+      synced = true;
+      last = hdr;
+      ++frames;
+
+      // the frame is sent right after its last sample
+      for (uint8_t i = 0; i < hdr.count; i++) {
+        const uint64_t age = (uint64_t)(hdr.count - 1 - i) * hdr.interval;
+        const uint32_t device_ms = hdr.timestamp + i * hdr.interval;
+        if (csv)
+          std::fprintf(csv, "%llu,%lu,%.4f\n", (unsigned long long)(now - age),
+                       (unsigned long)device_ms, lux_decode(codes[i]));
+        if (bin) {
+          struct Record rec = {now - age, codes[i]};
+          std::fwrite(&rec, sizeof(rec), 1, bin);
+        }
+      }
+      if (csv)
+        std::fflush(csv);
+      if (bin)
+        std::fflush(bin);
+    }
+  }
+
+  std::fprintf(stderr, "%lu frame(s), %lu sample(s) lost, %lu restart(s)\n",
+               frames, missed, restarts);
+
+  if (csv && csv != stdout)
+    std::fclose(csv);
+  if (bin)
+    std::fclose(bin);
+  close(fd);
+
+  return 0;
+}
@@ -0,0 +1,180 @@
+/**
+ *  @file    Arduino.h
+ *  @brief   Host Stand-In for the AVR Arduino Core, with a Virtual Clock
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *  @details Time only advances when the firmware idles or delays: the clock
+ *           then jumps to the next Timer0 tick or Timer1 compare match,
+ *           whichever comes first, and the latter runs the ADC interrupt
+ *           with a conversion of the simulated photo cell. Running the
+ *           firmware therefore takes no virtual time, which keeps runs
+ *           deterministic; its host cost is measured separately.
+ *
+ ***********************************************/
+
+#ifndef SIMULATOR_ARDUINO_H
+#define SIMULATOR_ARDUINO_H
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define F_CPU 16000000ul
+
+#define LED_BUILTIN 13
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+#define LOW 0x0
+#define HIGH 0x1
+#define FALLING 2
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_float(p) (*(const float *)(p))
+#define strcpy_P strcpy
+#define snprintf_P snprintf
+
+#define _BV(bit) (1 << (bit))
+
+// the registers the firmware touches, as plain variables
+inline uint8_t ADMUX, ADCSRA, ADCSRB, DIDR0, TCCR1A, TCCR1B, TIFR1;
+inline uint16_t ADC, OCR1A, OCR1B, TCNT1;
+
+#define REFS0 6
+#define ADEN 7
+#define ADATE 5
+#define ADIE 3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+#define ADTS2 2
+#define ADTS0 0
+#define WGM12 3
+#define CS11 1
+#define OCF1B 2
+
+#define ISR(vector) void vector()
+void ADC_vect();
+
+inline void cli() {}
+inline void sei() {}
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+struct Simulator {
+  uint64_t ns = 0;            // virtual time
+  double speed = 0.0;         // virtual over real time, 0 is unthrottled
+  float (*adc)(double s) = 0; // photo cell ADC reading at a time in s
+  bool timer1 = false;
+  uint64_t timer1_next = 0;
+  unsigned long conversions = 0;
+  uint64_t isr_ns = 0; // host time spent in the ADC interrupt
+  std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+};
+
+inline Simulator simulator;
+
+inline unsigned long micros() { return (uint32_t)(simulator.ns / 1000ull); }
+
+inline unsigned long millis() { return (uint32_t)(simulator.ns / 1000000ull); }
+
+inline uint16_t simulator_convert() {
+  static uint32_t seed = 1;
+  seed = seed * 1103515245u + 12345u; // half an LSB of dither
+  const float dither = ((seed >> 16) & 0x7FFF) / 32768.0f - 0.5f;
+  const float v = simulator.adc ? simulator.adc(simulator.ns * 1e-9) : 0.0f;
+  const long adc = lroundf(v + dither);
+  return adc < 0 ? 0 : adc > 1023 ? 1023 : adc;
+}
+
+// advances to the next interrupt: a Timer0 tick or an ADC conversion
+inline void simulator_idle() {
+  Simulator &sim = simulator;
+  const bool running = TCCR1B & _BV(CS11);
+  const uint64_t period = (OCR1B + 1ull) * 8ull * 1000000000ull / F_CPU;
+  if (running && !sim.timer1)
+    sim.timer1_next = sim.ns + period;
+  sim.timer1 = running;
+
+  const uint64_t tick = (sim.ns / 1000000ull + 1ull) * 1000000ull;
+  if (sim.timer1 && sim.timer1_next <= tick) {
+    sim.ns = sim.timer1_next;
+    sim.timer1_next += period;
+    if (ADCSRA & _BV(ADEN)) {
+      ADC = simulator_convert();
+      ++sim.conversions;
+      auto t = std::chrono::steady_clock::now();
+      ADC_vect();
+      sim.isr_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - t)
+                        .count();
+      sim.timer1 = TCCR1B & _BV(CS11);
+    }
+  } else
+    sim.ns = tick;
+
+  if (sim.speed > 0.0 && sim.ns % 10000000ull == 0) { // every 10ms
+    auto due = sim.epoch + std::chrono::nanoseconds(
+                               (uint64_t)(sim.ns / sim.speed));
+    if (due > std::chrono::steady_clock::now())
+      std::this_thread::sleep_until(due);
+  }
+}
+
+inline void delay(unsigned long ms) {
+  const uint64_t until = simulator.ns + ms * 1000000ull;
+  while (simulator.ns < until)
+    simulator_idle();
+}
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return HIGH; }
+inline int analogRead(uint8_t) { return simulator_convert(); }
+
+inline void (*simulator_button)() = nullptr;
+inline uint8_t digitalPinToInterrupt(uint8_t pin) { return pin - 2; }
+inline void attachInterrupt(uint8_t, void (*isr)(), int) {
+  simulator_button = isr;
+}
+
+class __FlashStringHelper;
+#define F(s) ((const __FlashStringHelper *)(s))
+
+// captures everything written, nothing is ever received
+class Stream {
+public:
+  std::vector<uint8_t> tx;
+
+  int available() { return 0; }
+  int read() { return -1; }
+
+  size_t write(const uint8_t *buf, size_t len) {
+    tx.insert(tx.end(), buf, buf + len);
+    return len;
+  }
+  size_t write(uint8_t c) { return write(&c, 1); }
+
+  size_t print(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+  size_t print(const __FlashStringHelper *s) { return print((const char *)s); }
+  template <typename T> size_t println(T v) { return print(v) + write('\n'); }
+};
+
+#define SERIAL_TX_BUFFER_SIZE 64
+
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long) {}
+};
+
+inline HardwareSerial Serial;
+
+#endif // SIMULATOR_ARDUINO_H
@@ -0,0 +1,136 @@
+/**
+ *  @file    U8g2lib.h
+ *  @brief   Headless Host Stand-In for U8g2, Drawing into a Bitmap
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *  @details Shapes are drawn into a 128x32 bitmap, text is measured but
+ *           drawn as an outline of its bounding box. As on the device, a
+ *           frame is drawn in two 16-row pages, each clipped to its rows.
+ *
+ ***********************************************/
+
+#ifndef SIMULATOR_U8G2LIB_H
+#define SIMULATOR_U8G2LIB_H
+
+#include "Arduino.h"
+
+#include <fstream>
+
+#define U8G2_DRAW_UPPER_RIGHT 0x01
+#define U8G2_DRAW_UPPER_LEFT 0x02
+#define U8G2_DRAW_LOWER_LEFT 0x04
+#define U8G2_DRAW_LOWER_RIGHT 0x08
+
+// glyph width and ascent in pixels
+inline const uint8_t u8g2_font_inr16_mr[] = {14, 16};
+inline const uint8_t u8g2_font_5x8_tf[] = {5, 7};
+inline const uint8_t u8g2_font_4x6_tf[] = {4, 5};
+
+struct u8g2_cb_t {};
+inline const u8g2_cb_t u8g2_cb_r0 = {};
+#define U8G2_R0 (&u8g2_cb_r0)
+
+class U8G2_SSD1306_128X32_UNIVISION_2_HW_I2C {
+public:
+  static const int width = 128, height = 32, page_height = 16;
+
+  unsigned long frames = 0;
+  bool power_save = false;
+
+  explicit U8G2_SSD1306_128X32_UNIVISION_2_HW_I2C(const u8g2_cb_t *) {}
+
+  bool begin() { return true; }
+  void setContrast(uint8_t) {}
+  void setPowerSave(uint8_t on) { power_save = on; }
+  void setFont(const uint8_t *font) { font_ = font; }
+
+  void firstPage() {
+    std::memset(buffer_, 0, sizeof(buffer_));
+    page_ = 0;
+  }
+
+  bool nextPage() {
+    if (++page_ * page_height < height)
+      return true;
+    std::memcpy(screen_, buffer_, sizeof(buffer_));
+    ++frames;
+    return false;
+  }
+
+  void drawPixel(int x, int y) {
+    if (x >= 0 && x < width && y >= page_ * page_height &&
+        y < (page_ + 1) * page_height)
+      buffer_[y][x] = 1;
+  }
+
+  void drawVLine(int x, int y, int h) {
+    for (int j = 0; j < h; j++)
+      drawPixel(x, y + j);
+  }
+
+  void drawHLine(int x, int y, int w) {
+    for (int i = 0; i < w; i++)
+      drawPixel(x + i, y);
+  }
+
+  void drawBox(int x, int y, int w, int h) {
+    for (int j = 0; j < h; j++)
+      drawHLine(x, y + j, w);
+  }
+
+  void drawFrame(int x, int y, int w, int h) {
+    drawHLine(x, y, w);
+    drawHLine(x, y + h - 1, w);
+    drawVLine(x, y, h);
+    drawVLine(x + w - 1, y, h);
+  }
+
+  void drawCircle(int x0, int y0, int r) {
+    for (int y = -r; y <= r; y++)
+      for (int x = -r; x <= r; x++) {
+        const int d = x * x + y * y;
+        if (d <= r * r && d > (r - 1) * (r - 1))
+          drawPixel(x0 + x, y0 + y);
+      }
+  }
+
+  void drawDisc(int x0, int y0, int r, uint8_t opt) {
+    for (int y = -r; y <= r; y++)
+      for (int x = -r; x <= r; x++) {
+        const uint8_t quadrant = y <= 0 ? (x >= 0 ? U8G2_DRAW_UPPER_RIGHT
+                                                  : U8G2_DRAW_UPPER_LEFT)
+                                        : (x >= 0 ? U8G2_DRAW_LOWER_RIGHT
+                                                  : U8G2_DRAW_LOWER_LEFT);
+        if (x * x + y * y <= r * r && (opt & quadrant))
+          drawPixel(x0 + x, y0 + y);
+      }
+  }
+
+  // y is the baseline
+  int drawStr(int x, int y, const char *s) {
+    const int w = font_[0] * std::strlen(s);
+    if (w)
+      drawFrame(x, y - font_[1] + 1, w, font_[1]);
+    return w;
+  }
+
+  bool writePBM(const std::string &path) const {
+    std::ofstream ofs(path);
+    ofs << "P1\n" << width << ' ' << height << '\n';
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++)
+        ofs << (power_save ? 0 : (int)screen_[y][x]) << (x + 1 < width ? " " : "");
+      ofs << '\n';
+    }
+    return (bool)ofs;
+  }
+
+private:
+  const uint8_t *font_ = u8g2_font_5x8_tf;
+  int page_ = 0;
+  uint8_t buffer_[height][width];
+  uint8_t screen_[height][width] = {{0}};
+};
+
+#endif // SIMULATOR_U8G2LIB_H
@@ -0,0 +1,17 @@
+/**
+ *  @file    Wire.h
+ *  @brief   Host Stand-In for the Arduino I2C Library
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *
+ ***********************************************/
+
+#ifndef SIMULATOR_WIRE_H
+#define SIMULATOR_WIRE_H
+
+class TwoWire {};
+
+inline TwoWire Wire;
+
+#endif // SIMULATOR_WIRE_H
@@ -0,0 +1,53 @@
+/**
+ *  @file    eeprom.h
+ *  @brief   Host Stand-In for the AVR EEPROM, with Write Timing and Wear
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *
+ ***********************************************/
+
+#ifndef SIMULATOR_AVR_EEPROM_H
+#define SIMULATOR_AVR_EEPROM_H
+
+#include "../Arduino.h"
+
+#define E2END 0x3FF
+
+#define EEPROM_WRITE_NS 3400000ull
+
+struct EEPROM {
+  uint8_t data[E2END + 1];
+  uint32_t writes[E2END + 1];
+  uint64_t ready; // virtual time in ns
+};
+
+inline EEPROM eeprom = {{0}, {0}, 0};
+
+inline bool eeprom_is_ready() { return simulator.ns >= eeprom.ready; }
+
+inline void eeprom_busy_wait() {
+  while (!eeprom_is_ready())
+    simulator_idle();
+}
+
+inline void eeprom_read_block(void *dst, const void *src, size_t n) {
+  eeprom_busy_wait();
+  std::memcpy(dst, eeprom.data + (uintptr_t)src, n);
+}
+
+inline void eeprom_update_byte(uint8_t *addr, uint8_t value) {
+  eeprom_busy_wait();
+  if (eeprom.data[(uintptr_t)addr] == value)
+    return;
+  eeprom.data[(uintptr_t)addr] = value;
+  ++eeprom.writes[(uintptr_t)addr];
+  eeprom.ready = simulator.ns + EEPROM_WRITE_NS;
+}
+
+inline void eeprom_update_block(const void *src, void *dst, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    eeprom_update_byte((uint8_t *)dst + i, ((const uint8_t *)src)[i]);
+}
+
+#endif // SIMULATOR_AVR_EEPROM_H
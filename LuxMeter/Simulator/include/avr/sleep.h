@@ -0,0 +1,22 @@
+/**
+ *  @file    sleep.h
+ *  @brief   Host Stand-In for AVR Sleep Modes
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *
+ ***********************************************/
+
+#ifndef SIMULATOR_AVR_SLEEP_H
+#define SIMULATOR_AVR_SLEEP_H
+
+#include "../Arduino.h"
+
+#define SLEEP_MODE_IDLE 0
+
+inline void set_sleep_mode(uint8_t) {}
+inline void sleep_enable() {}
+inline void sleep_disable() {}
+inline void sleep_cpu() { simulator_idle(); }
+
+#endif // SIMULATOR_AVR_SLEEP_H
@@ -0,0 +1,73 @@
+/**
+ *  @file    luxtable.cpp
+ *  @brief   Host Check of the Lux Lookup Table
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *  @details Compares lux_lookup() against the datasheet formula, evaluated
+ *           in double precision at run time, for all 1024 ADC codes, checks
+ *           that it never decreases, and that lux_lookup_fraction() agrees
+ *           with it on whole codes. Build with -DLUX_TABLE_STEP to check
+ *           another step; the exit status is non-zero on failure.
+ *
+ ***********************************************/
+
+#include "Arduino.h"
+
+#include "../../src/LuxTable.h"
+
+#include <cmath>
+
+// the datasheet formula, as lux_from_adc() but not at compile time
+static double lux_exact(uint16_t adc) {
+  if (adc == 0)
+    return 0.0;
+  if (adc >= 1023)
+    adc = 1022;
+  return std::pow(10.0, 3.2784 - std::log10((1023.0 - adc) / adc) * 1.63675);
+}
+
+int main() {
+  int failures = 0;
+  double worst = 0.0, worst_above = 0.0;
+  uint16_t worst_adc = 0;
+  float last = 0.0f;
+
+  for (uint16_t adc = 0; adc < 1024; adc++) {
+    const double exact = lux_exact(adc);
+    const float lux = lux_lookup(adc);
+    const double err = std::fabs(lux - exact) / (exact > 1.0 ? exact : 1.0);
+    if (adc <= 960 && err > worst) {
+      worst = err;
+      worst_adc = adc;
+    } else if (adc > 960 && err > worst_above)
+      worst_above = err;
+
+    if (lux < last) {
+      printf("ADC %u: %g lux is below the %g lux of ADC %u\n", adc, lux, last,
+             adc - 1);
+      failures++;
+    }
+    last = lux;
+
+    for (uint8_t bits = 0; bits <= 3; bits++) {
+      const float fraction = lux_lookup_fraction(adc << bits, bits);
+      if (std::fabs(fraction - lux) > 1e-6f * (lux > 1.0f ? lux : 1.0f)) {
+        printf("ADC %u: lux_lookup_fraction(%u, %u) is %g, not %g\n", adc,
+               adc << bits, bits, fraction, lux);
+        failures++;
+      }
+    }
+  }
+
+  printf("LUX_TABLE_STEP %d, %u bytes: max. error %.3g%% at ADC %u (bound "
+         "%.3g%%), %.3g%% above ADC 960\n",
+         LUX_TABLE_STEP, (unsigned)sizeof(lux_table), 100.0 * worst,
+         worst_adc, 100.0 * LUX_TABLE_ERROR, 100.0 * worst_above);
+  if (worst > LUX_TABLE_ERROR) {
+    printf("error exceeds the documented bound\n");
+    failures++;
+  }
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,282 @@
+/**
+ *  @file    main.cpp
+ *  @brief   Lux Meter Host Simulator
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *  @details Builds the firmware against a virtual clock, a simulated ADC,
+ *           EEPROM, and Serial, and a headless OLED. It replays a recorded
+ *           ADC trace, or a synthetic day, at a multiple of real time and
+ *           reports the host time spent per task, the Serial traffic, the
+ *           rendered frames, and the EEPROM wear. Runs are deterministic, so
+ *           the printed history can serve as a regression reference.
+ *
+ ***********************************************/
+
+#define SCHEDULER_STATS 1
+#include "../../src/main.cpp"
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <utility>
+
+static const char *usage =
+    "usage: %s [-t trace] [-d seconds] [-x speed] [-e eeprom.bin] "
+    "[-o frame.pbm] [-v view] [-r]\n"
+    "  -t  replay an ADC trace of '<ms> <adc>' lines, each value held until "
+    "the next\n"
+    "  -d  virtual seconds to run (the trace's length, or a day)\n"
+    "  -x  virtual over real time, 0 runs as fast as possible (1000)\n"
+    "  -e  load the EEPROM from, and save it to, this file\n"
+    "  -o  write the last OLED frame as PBM\n"
+    "  -v  history view: 0 10s, 1 minutes, 2 hours, or 3 days (0)\n"
+    "  -r  print the history and the tiers\n";
+
+static std::vector<std::pair<double, float>> trace; // in s, ADC
+
+float trace_adc(double s) {
+  static size_t i = 0; // time only moves forward
+  while (i + 1 < trace.size() && trace[i + 1].first <= s)
+    ++i;
+  return trace[i].second;
+}
+
+bool trace_load(const char *path) {
+  std::ifstream ifs(path);
+  std::string line;
+  while (std::getline(ifs, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+    std::istringstream iss(line);
+    double ms;
+    float adc;
+    if (iss >> ms >> adc)
+      trace.emplace_back(ms / 1000.0, adc);
+  }
+  std::sort(trace.begin(), trace.end(),
+            [](const std::pair<double, float> &a,
+               const std::pair<double, float> &b) { return a.first < b.first; });
+  return !trace.empty();
+}
+
+// starting at midnight: daylight through a window from 6h to 20h, and a lamp,
+// flickering at 100Hz, on from 18h to 23h and toggled every 10s for six
+// minutes at 19h
+float synthetic_adc(double s) {
+  const double h = std::fmod(s / 3600.0, 24.0);
+  double adc = 20.0;
+  if (h > 6.0 && h < 20.0)
+    adc += 500.0 * std::sin(M_PI * (h - 6.0) / 14.0);
+  if (h >= 18.0 && h < 23.0 &&
+      !(h >= 19.0 && h < 19.1 && std::fmod(s, 20.0) < 10.0))
+    adc += 300.0 + 30.0 * std::sin(2.0 * M_PI * 100.0 * s);
+  return adc;
+}
+
+// wraps every task to measure its host time
+static void (*task_run_fn[TASK_NUMBER])();
+static unsigned long task_calls[TASK_NUMBER];
+static uint64_t task_ns[TASK_NUMBER];
+
+template <size_t I> void task_probe() {
+  auto t = std::chrono::steady_clock::now();
+  task_run_fn[I]();
+  task_ns[I] += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - t)
+                    .count();
+  ++task_calls[I];
+}
+
+template <size_t... I> void task_probe_all(std::index_sequence<I...>) {
+  ((task_run_fn[I] = tasks[I].run, tasks[I].run = task_probe<I>), ...);
+}
+
+// counts valid frames and their samples, and anything else on the line
+void serial_report(const std::vector<uint8_t> &tx) {
+  unsigned long frames = 0, samples = 0, other = 0;
+  size_t i = 0;
+  while (i < tx.size()) {
+    struct TelemetryHeader hdr;
+    if (tx[i] == TELEMETRY_SYNC0 && tx.size() - i >= sizeof(hdr)) {
+      std::memcpy(&hdr, &tx[i], sizeof(hdr));
+      const size_t len = sizeof(hdr) + hdr.count * sizeof(uint16_t);
+      uint16_t crc;
+      if (hdr.sync[1] == TELEMETRY_SYNC1 && tx.size() - i >= len + 2) {
+        std::memcpy(&crc, &tx[i + len], sizeof(crc));
+        if (telemetry_crc16(0, &tx[i + 2], len - 2) == crc) {
+          ++frames;
+          samples += hdr.count;
+          i += len + sizeof(crc);
+          continue;
+        }
+      }
+    }
+    ++other;
+    ++i;
+  }
+  std::printf("serial: %zu bytes, %lu frames with %lu samples, %lu other "
+              "bytes\n",
+              tx.size(), frames, samples, other);
+}
+
+void history_report() {
+  std::printf("\nhistory (s since boot, lux), newest first\n");
+  unsigned long t = history_time;
+  for (uint8_t i = 0; i < lux_history.size(); i++) {
+    std::printf("%7lu %10.2f\n", t, lux_decode(lux_history[i].code));
+    t -= lux_history[i].delta;
+  }
+
+  const char *names[] = {"minutes", "hours", "days"};
+  for (uint8_t t = 0; t < 3; t++) {
+    std::printf("\n%s (min, mean, max lux), newest first\n", names[t]);
+    const uint8_t size = t == 0   ? lux_minutes.size()
+                         : t == 1 ? lux_hours.size()
+                                  : lux_days.size();
+    for (uint8_t i = 0; i < size; i++) {
+      const RoundRobinSlot &slot = t == 0   ? lux_minutes[i]
+                                   : t == 1 ? lux_hours[i]
+                                            : lux_days[i];
+      std::printf("%3u %10.2f %10.2f %10.2f\n", i, lux_decode(slot.min),
+                  lux_decode(slot.mean), lux_decode(slot.max));
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+
+  const char *trace_path = nullptr, *eeprom_path = nullptr,
+             *pbm_path = nullptr;
+  double seconds = 0.0;
+  int view = HISTORY_RAW;
+  bool report = false;
+  simulator.speed = 1000.0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "t:d:x:e:o:v:r")) != -1) {
+    switch (opt) {
+    case 't':
+      trace_path = optarg;
+      break;
+    case 'd':
+      seconds = std::atof(optarg);
+      break;
+    case 'x':
+      simulator.speed = std::atof(optarg);
+      break;
+    case 'e':
+      eeprom_path = optarg;
+      break;
+    case 'o':
+      pbm_path = optarg;
+      break;
+    case 'v':
+      view = std::atoi(optarg);
+      break;
+    case 'r':
+      report = true;
+      break;
+    default:
+      std::fprintf(stderr, usage, argv[0]);
+      return 1;
+    }
+  }
+
+  if (optind != argc || view < 0 || view >= HISTORY_VIEWS ||
+      seconds < 0.0 || simulator.speed < 0.0) {
+    std::fprintf(stderr, usage, argv[0]);
+    return 1;
+  }
+
+  if (trace_path) {
+    if (!trace_load(trace_path)) {
+      std::fprintf(stderr, "failed to read a trace from '%s'\n", trace_path);
+      return 1;
+    }
+    simulator.adc = trace_adc;
+    if (seconds == 0.0)
+      seconds = trace.back().first;
+  } else
+    simulator.adc = synthetic_adc;
+  if (seconds == 0.0)
+    seconds = 86400.0;
+
+  std::memset(eeprom.data, 0xFF, sizeof(eeprom.data)); // erased
+  if (eeprom_path) {
+    std::ifstream ifs(eeprom_path, std::ios::binary);
+    ifs.read((char *)eeprom.data, sizeof(eeprom.data));
+  }
+
+  task_probe_all(std::make_index_sequence<TASK_NUMBER>());
+
+  simulator.epoch = std::chrono::steady_clock::now();
+
+  setup();
+
+  // the journal is formatted in setup() on first use, which isn't wear
+  uint32_t writes[E2END + 1];
+  std::memcpy(writes, eeprom.writes, sizeof(writes));
+  const uint64_t start_ns = simulator.ns;
+
+  history_view = view;
+  history_dirty = true;
+
+  const uint64_t end_ns = (uint64_t)(seconds * 1e9);
+  while (simulator.ns < end_ns)
+    loop();
+
+  const double wall = std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - simulator.epoch)
+                          .count(),
+               virt = simulator.ns * 1e-9;
+  std::printf("virtual %.1f s in %.1f s, %.0fx real time\n", virt, wall,
+              virt / wall);
+
+  std::printf("\n%-10s %10s %12s %10s %10s %9s\n", "task", "runs", "host(us)",
+              "(ns)/run", "host(%)", "late(ms)");
+  for (uint8_t i = 0; i < TASK_NUMBER; i++)
+    std::printf("%-10s %10lu %12.0f %10.0f %10.4f %9u\n", task_names[i],
+                task_calls[i], task_ns[i] * 1e-3,
+                task_calls[i] ? (double)task_ns[i] / task_calls[i] : 0.0,
+                100.0 * task_ns[i] / simulator.ns, task_stats[i].late_max_ms);
+  std::printf("%-10s %10lu %12.0f %10.0f %10.4f\n", "adc isr",
+              simulator.conversions, simulator.isr_ns * 1e-3,
+              simulator.conversions
+                  ? (double)simulator.isr_ns / simulator.conversions
+                  : 0.0,
+              100.0 * simulator.isr_ns / simulator.ns);
+  std::printf("\n");
+
+  serial_report(Serial.tx);
+  std::printf("oled: %lu frames\n", u8g2.frames);
+
+  unsigned long total = 0;
+  uint32_t most = 0;
+  for (size_t i = 0; i <= E2END; i++) {
+    total += eeprom.writes[i] - writes[i];
+    most = std::max(most, eeprom.writes[i] - writes[i]);
+  }
+  const double days = (simulator.ns - start_ns) * 1e-9 / 86400.0;
+  std::printf("eeprom: %lu byte writes, at most %u to a byte", total, most);
+  if (most)
+    std::printf(", 100k cycles last %.1f years", 1e5 / (most / days) / 365.0);
+  std::printf("\n");
+
+  if (report)
+    history_report();
+
+  if (pbm_path && !u8g2.writePBM(pbm_path)) {
+    std::fprintf(stderr, "failed to write '%s'\n", pbm_path);
+    return 1;
+  }
+
+  if (eeprom_path) {
+    std::ofstream ofs(eeprom_path, std::ios::binary);
+    ofs.write((const char *)eeprom.data, sizeof(eeprom.data));
+  }
+
+  return 0;
+}
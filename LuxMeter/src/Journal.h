@@ -0,0 +1,146 @@
+/**
+ *  @file    Journal.h
+ *  @brief   Wear-Levelled EEPROM Journal of Round-Robin Slots
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-06
+ *  @note    BSD-3 licensed
+ *  @details A Journal keeps N 8-byte records in a circular EEPROM region
+ *           starting at BASE: a sequence number, a RoundRobinSlot, and a
+ *           CRC-8. Only a newly completed slot is appended, at the head, so
+ *           each record is rewritten once every N slots. The append is
+ *           written a byte at a time by write(), whenever the EEPROM is ready,
+ *           so the ~3.4ms byte writes never block the caller.
+ *
+ *           At boot, restore() finds the newest record as the last valid one
+ *           of an unbroken sequence and replays up to a tier's capacity of
+ *           records before it, reading at most 3N - 2 records: N + 1 to find
+ *           it, N - 2 to walk back, and N - 1 to replay. The sequence number
+ *           is written last, so a record torn by a reset keeps its old number
+ *           and is never taken for a new one. It is also never replayed, as
+ *           at most N - 1 records are, so a journal needs one spare record.
+ *
+ ***********************************************/
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <avr/eeprom.h>
+#include <stdint.h>
+
+#include "RoundRobin.h"
+
+#define JOURNAL_RECORD 8 // bytes
+
+struct __attribute__((packed)) JournalRecord {
+  uint8_t seq;
+  RoundRobinSlot slot;
+  uint8_t crc;
+};
+
+static_assert(sizeof(struct JournalRecord) == JOURNAL_RECORD,
+              "journal records must be 8 bytes");
+
+inline uint8_t journal_crc8(const struct JournalRecord &record) {
+  const uint8_t *data = (const uint8_t *)&record;
+  uint8_t crc = 0xFF;
+  for (uint8_t n = 0; n < JOURNAL_RECORD - 1; n++) {
+    crc ^= data[n];
+    for (uint8_t i = 0; i < 8; i++)
+      crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+  }
+  return crc;
+}
+
+template <uint16_t BASE, uint8_t N> class Journal {
+public:
+  static_assert(N > 1 && N < 255, "sequence numbers must not wrap around");
+
+  static constexpr uint16_t end = BASE + N * JOURNAL_RECORD;
+
+  // invalidates all records; blocks for up to ~3.4ms per changed byte
+  void format() {
+    struct JournalRecord record = {0, {0, 0, 0}, 0};
+    record.crc = ~journal_crc8(record);
+    for (uint8_t i = 0; i < N; i++)
+      eeprom_update_block(&record, address(i), JOURNAL_RECORD);
+    head_ = seq_ = 0;
+    pos_ = JOURNAL_RECORD;
+  }
+
+  template <typename Tier> void restore(Tier &tier) {
+    struct JournalRecord record, next;
+    // each record is read once, as the successor of the one before it
+    bool valid = read(0, record);
+    uint8_t newest = N;
+    for (uint8_t i = 0; i < N; i++) {
+      const bool next_valid = read(i + 1 < N ? i + 1 : 0, next);
+      if (valid && !(next_valid && next.seq == (uint8_t)(record.seq + 1))) {
+        newest = i;
+        break;
+      }
+      record = next;
+      valid = next_valid;
+    }
+    if (newest == N) // empty
+      return;
+
+    head_ = newest + 1 < N ? newest + 1 : 0;
+    seq_ = record.seq + 1;
+
+    uint8_t oldest = newest, len = 1;
+    for (uint8_t seq = record.seq; len < tier.capacity() && len < N - 1;
+         ++len) {
+      const uint8_t prev = oldest ? oldest - 1 : N - 1;
+      if (!read(prev, next) || next.seq != (uint8_t)(seq - 1))
+        break;
+      seq = next.seq;
+      oldest = prev;
+    }
+
+    for (uint8_t i = oldest; len--; i = i + 1 < N ? i + 1 : 0) {
+      read(i, record);
+      tier.push(record.slot);
+    }
+  }
+
+  void append(const RoundRobinSlot &slot) {
+    record_.seq = seq_++;
+    record_.slot = slot;
+    record_.crc = journal_crc8(record_);
+    index_ = head_;
+    if (++head_ == N)
+      head_ = 0;
+    pos_ = 0;
+  }
+
+  bool busy() const { return pos_ < JOURNAL_RECORD; }
+
+  // writes the next byte of the pending append, if the EEPROM is ready; the
+  // sequence number goes last
+  void write() {
+    if (!busy() || !eeprom_is_ready())
+      return;
+    const uint8_t n = pos_ + 1 < JOURNAL_RECORD ? pos_ + 1 : 0;
+    eeprom_update_byte((uint8_t *)address(index_) + n,
+                       ((const uint8_t *)&record_)[n]);
+    ++pos_;
+  }
+
+private:
+  static void *address(uint8_t i) {
+    return (void *)(uintptr_t)(BASE + i * JOURNAL_RECORD);
+  }
+
+  static bool read(uint8_t i, struct JournalRecord &record) {
+    eeprom_read_block(&record, address(i), JOURNAL_RECORD);
+    return journal_crc8(record) == record.crc;
+  }
+
+  struct JournalRecord record_;
+  uint8_t head_ = 0;
+  uint8_t index_ = 0;
+  uint8_t seq_ = 0;
+  uint8_t pos_ = JOURNAL_RECORD;
+};
+
+#endif // JOURNAL_H
@@ -0,0 +1,142 @@
+/**
+ *  @file    LuxTable.h
+ *  @brief   Lookup Table for KLS6 Photo Cell Lux Conversion
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-06
+ *  @note    BSD-3 licensed
+ *  @details The datasheet conversion takes a log10 and a pow per sample,
+ *           which costs thousands of cycles in soft-float. Instead, the lux
+ *           for every LUX_TABLE_STEP'th ADC value is computed at compile
+ *           time and stored in PROGMEM, with linear interpolation for the
+ *           values in between. The SensorPod includes it as well. Define
+ *           LUX_TABLE_STEP before including to trade accuracy for flash:
+ *
+ *           step  flash  max. error (ADC <= 960, i.e., <100k lux)
+ *             1   4100B  exact
+ *             2   2052B  1.3%
+ *             4   1028B  4%
+ *             8    516B  13%
+ *            16    260B  40%
+ *
+ *           Below 1 lux the error is absolute rather than relative.
+ *
+ ***********************************************/
+
+#ifndef LUXTABLE_H
+#define LUXTABLE_H
+
+#include <Arduino.h>
+
+#ifndef LUX_TABLE_STEP
+#define LUX_TABLE_STEP 1
+#endif
+
+#define LUX_TABLE_SIZE (1024 / LUX_TABLE_STEP + 1)
+
+// 1kOhm resistor in voltage divider, from datasheet; ADC 0 is complete
+// darkness and ADC 1023 (Rphoto = 0) saturates at the ADC 1022 value
+constexpr float lux_from_adc(uint16_t adc) {
+  return adc == 0 ? 0.0f
+         : adc >= 1023
+             ? lux_from_adc(1022)
+             : (float)__builtin_pow(
+                   10.0, 3.2784 - __builtin_log10((1023.0 - adc) / adc) *
+                                      1.63675);
+}
+
+#define LUX_ENTRY(k) lux_from_adc((k)*LUX_TABLE_STEP)
+#define LUX_ENTRY4(k)                                                          \
+  LUX_ENTRY(k), LUX_ENTRY(k + 1), LUX_ENTRY(k + 2), LUX_ENTRY(k + 3)
+#define LUX_ENTRY16(k)                                                         \
+  LUX_ENTRY4(k), LUX_ENTRY4(k + 4), LUX_ENTRY4(k + 8), LUX_ENTRY4(k + 12)
+#define LUX_ENTRY64(k)                                                         \
+  LUX_ENTRY16(k), LUX_ENTRY16(k + 16), LUX_ENTRY16(k + 32),                    \
+      LUX_ENTRY16(k + 48)
+#define LUX_ENTRY256(k)                                                        \
+  LUX_ENTRY64(k), LUX_ENTRY64(k + 64), LUX_ENTRY64(k + 128),                   \
+      LUX_ENTRY64(k + 192)
+
+static constexpr float lux_table[LUX_TABLE_SIZE] PROGMEM = {
+#if LUX_TABLE_STEP == 1
+    LUX_ENTRY256(0), LUX_ENTRY256(256), LUX_ENTRY256(512), LUX_ENTRY256(768),
+    LUX_ENTRY(1024)
+#elif LUX_TABLE_STEP == 2
+    LUX_ENTRY256(0), LUX_ENTRY256(256), LUX_ENTRY(512)
+#elif LUX_TABLE_STEP == 4
+    LUX_ENTRY256(0), LUX_ENTRY(256)
+#elif LUX_TABLE_STEP == 8
+    LUX_ENTRY64(0), LUX_ENTRY64(64), LUX_ENTRY(128)
+#elif LUX_TABLE_STEP == 16
+    LUX_ENTRY64(0), LUX_ENTRY(64)
+#else
+#error "LUX_TABLE_STEP must be 1, 2, 4, 8, or 16"
+#endif
+};
+
+inline float lux_lookup(uint16_t adc) {
+  if (adc > 1023)
+    adc = 1023;
+#if LUX_TABLE_STEP == 1
+  return pgm_read_float(&lux_table[adc]);
+#else
+  const uint16_t k = adc / LUX_TABLE_STEP;
+  const float lo = pgm_read_float(&lux_table[k]),
+              hi = pgm_read_float(&lux_table[k + 1]);
+  return lo + (hi - lo) * (float)(adc % LUX_TABLE_STEP) / LUX_TABLE_STEP;
+#endif
+}
+
+// for oversampled readings, with adc in 1/2^bits ADC counts
+inline float lux_lookup_fraction(uint16_t adc, uint8_t bits) {
+  const uint16_t step = (uint16_t)LUX_TABLE_STEP << bits,
+                 k = adc / step < LUX_TABLE_SIZE - 1 ? adc / step
+                                                     : LUX_TABLE_SIZE - 2;
+  const float lo = pgm_read_float(&lux_table[k]),
+              hi = pgm_read_float(&lux_table[k + 1]);
+  return lo + (hi - lo) * (float)(adc - k * step) / step;
+}
+
+// compile-time bound on the lookup error against the datasheet formula
+
+constexpr float lux_interpolated(uint16_t adc) {
+  return lux_table[adc / LUX_TABLE_STEP] +
+         (lux_table[adc / LUX_TABLE_STEP + 1] -
+          lux_table[adc / LUX_TABLE_STEP]) *
+             (float)(adc % LUX_TABLE_STEP) / LUX_TABLE_STEP;
+}
+
+constexpr float lux_error(uint16_t adc) {
+  return (lux_interpolated(adc) > lux_from_adc(adc)
+              ? lux_interpolated(adc) - lux_from_adc(adc)
+              : lux_from_adc(adc) - lux_interpolated(adc)) /
+         (lux_from_adc(adc) > 1.0f ? lux_from_adc(adc) : 1.0f);
+}
+
+constexpr float lux_max(float a, float b) { return a > b ? a : b; }
+
+constexpr float lux_max_error(uint16_t lo, uint16_t hi) {
+  return hi - lo == 1 ? lux_error(lo)
+                      : lux_max(lux_max_error(lo, lo + (hi - lo) / 2),
+                                lux_max_error(lo + (hi - lo) / 2, hi));
+}
+
+#if LUX_TABLE_STEP == 1
+#define LUX_TABLE_ERROR 1e-6f
+#elif LUX_TABLE_STEP == 2
+#define LUX_TABLE_ERROR 0.02f
+#elif LUX_TABLE_STEP == 4
+#define LUX_TABLE_ERROR 0.05f
+#elif LUX_TABLE_STEP == 8
+#define LUX_TABLE_ERROR 0.15f
+#else
+#define LUX_TABLE_ERROR 0.4f
+#endif
+
+static_assert(lux_table[0] == 0.0f, "ADC 0 must map to 0 lux");
+static_assert(lux_table[LUX_TABLE_SIZE - 1] == lux_from_adc(1022) &&
+                  lux_interpolated(1023) <= lux_from_adc(1022),
+              "ADC 1023 must saturate");
+static_assert(lux_max_error(0, 961) <= LUX_TABLE_ERROR,
+              "lux lookup error exceeds its documented bound");
+
+#endif // LUXTABLE_H
@@ -0,0 +1,56 @@
+/**
+ *  @file    RingBuffer.h
+ *  @brief   Fixed-Capacity Ring Buffer
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-06
+ *  @note    BSD-3 licensed
+ *  @details Pushing overwrites the oldest value once full, in O(1) and
+ *           without moving the others. erase() takes a value out by moving
+ *           the older ones up. Index must be able to hold N.
+ *
+ ***********************************************/
+
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <stdint.h>
+
+template <typename T, uint16_t N, typename Index = uint8_t> class RingBuffer {
+public:
+  void push(T value) {
+    values_[head_] = value;
+    if (++head_ == N)
+      head_ = 0;
+    if (len_ < N)
+      ++len_;
+  }
+
+  // 0 is the most recent value
+  T operator[](Index i) const { return values_[position(i)]; }
+
+  T &operator[](Index i) { return values_[position(i)]; }
+
+  // in O(size() - i)
+  void erase(Index i) {
+    for (; i + 1 < len_; i++)
+      values_[position(i)] = values_[position(i + 1)];
+    --len_;
+  }
+
+  Index size() const { return len_; }
+
+  bool empty() const { return len_ == 0; }
+
+  void clear() { head_ = len_ = 0; }
+
+private:
+  Index position(Index i) const {
+    return head_ > i ? head_ - 1 - i : N + head_ - 1 - i;
+  }
+
+  T values_[N];
+  Index head_ = 0;
+  Index len_ = 0;
+};
+
+#endif // RINGBUFFER_H
@@ -0,0 +1,121 @@
+/**
+ *  @file    RoundRobin.h
+ *  @brief   Compact Lux Encoding and Round-Robin Consolidation Tiers
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-06
+ *  @note    BSD-3 licensed
+ *  @details Lux is stored in 16 bits as a monotonic, floating-point-like code
+ *           of the lux in 1/16 units: below 2048 the code is the value
+ *           itself, above it carries an exponent and a 10-bit mantissa.
+ *           That spans the full table range at 1/16 lux resolution below
+ *           128 lux and ~0.1% precision above, and, being monotonic, codes
+ *           compare like the values they encode.
+ *
+ *           A RoundRobinTier consolidates RATIO incoming (min, mean, max)
+ *           triplets into one slot, keeping the last N slots. Chaining tiers
+ *           builds a round-robin database in a fixed amount of SRAM.
+ *
+ ***********************************************/
+
+#ifndef ROUNDROBIN_H
+#define ROUNDROBIN_H
+
+#include <stdint.h>
+
+#define LUX_CODE_FRACTION 4 // bits
+
+inline uint16_t lux_encode(float lux) {
+  if (lux <= 0.0f)
+    return 0;
+  const float q = lux * (1 << LUX_CODE_FRACTION);
+  uint32_t x = q >= 4294967040.0f ? 0xFFFFFF00ul : (uint32_t)q;
+  if (x < 2048)
+    return x;
+  uint8_t e = 0;
+  while (x >= 2048) {
+    x >>= 1;
+    ++e;
+  }
+  return ((uint16_t)e << 10) + x;
+}
+
+inline uint32_t lux_decode_q(uint16_t code) {
+  if (code < 2048)
+    return code;
+  const uint8_t e = (code >> 10) - 1;
+  return ((uint32_t)((code & 0x3FF) | 0x400)) << e;
+}
+
+inline float lux_decode(uint16_t code) {
+  return (float)lux_decode_q(code) / (1 << LUX_CODE_FRACTION);
+}
+
+struct RoundRobinSlot {
+  uint16_t min;
+  uint16_t mean;
+  uint16_t max;
+};
+
+template <uint8_t N, uint8_t RATIO> class RoundRobinTier {
+public:
+  // returns true when a new slot was completed
+  bool add(uint16_t min, uint16_t mean, uint16_t max) {
+    if (count_ == 0 || min < acc_.min)
+      acc_.min = min;
+    if (count_ == 0 || max > acc_.max)
+      acc_.max = max;
+    sum_ += lux_decode(mean);
+    if (++count_ < RATIO)
+      return false;
+
+    acc_.mean = lux_encode(sum_ / RATIO);
+    push(acc_);
+    count_ = 0;
+    sum_ = 0.0f;
+    return true;
+  }
+
+  // stores a consolidated slot as is, e.g., when restoring
+  void push(const RoundRobinSlot &slot) {
+    slots_[head_] = slot;
+    if (++head_ == N)
+      head_ = 0;
+    if (len_ < N)
+      ++len_;
+  }
+
+  // 0 is the most recent slot
+  const RoundRobinSlot &operator[](uint8_t i) const {
+    return slots_[head_ > i ? head_ - 1 - i : N + head_ - 1 - i];
+  }
+
+  uint8_t size() const { return len_; }
+
+  uint8_t capacity() const { return N; }
+
+  uint16_t min() const {
+    uint16_t v = 0xFFFF;
+    for (uint8_t i = 0; i < len_; i++)
+      if (slots_[i].min < v)
+        v = slots_[i].min;
+    return len_ ? v : 0;
+  }
+
+  uint16_t max() const {
+    uint16_t v = 0;
+    for (uint8_t i = 0; i < len_; i++)
+      if (slots_[i].max > v)
+        v = slots_[i].max;
+    return v;
+  }
+
+private:
+  RoundRobinSlot slots_[N];
+  RoundRobinSlot acc_;
+  float sum_ = 0.0f;
+  uint8_t head_ = 0;
+  uint8_t len_ = 0;
+  uint8_t count_ = 0;
+};
+
+#endif // ROUNDROBIN_H
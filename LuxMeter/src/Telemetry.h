@@ -0,0 +1,46 @@
+/**
+ *  @file    Telemetry.h
+ *  @brief   Lux Meter Framed Telemetry Protocol
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-06
+ *  @note    BSD-3 licensed
+ *  @details Shared between the firmware and the host-side logger. A frame is
+ *           a TelemetryHeader, `count` little-endian 16-bit lux codes (see
+ *           RoundRobin.h) taken `interval` ms apart starting at `timestamp`
+ *           ms since boot, and a CRC-16/XMODEM over everything after the
+ *           sync bytes. The sequence number increments per frame, so a host
+ *           can tell how many samples it missed.
+ *
+ ***********************************************/
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TELEMETRY_SYNC0 0xA5
+#define TELEMETRY_SYNC1 0x5A
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_BATCH_MAX 64
+
+struct __attribute__((packed)) TelemetryHeader {
+  uint8_t sync[2];
+  uint8_t version;
+  uint8_t count;
+  uint16_t seq;
+  uint16_t interval;  // in ms
+  uint32_t timestamp; // in ms, of the first sample
+};
+
+static inline uint16_t telemetry_crc16(uint16_t crc, const uint8_t *data,
+                                       size_t len) {
+  while (len--) {
+    crc ^= (uint16_t)*data++ << 8;
+    for (uint8_t i = 0; i < 8; i++)
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+#endif // TELEMETRY_H
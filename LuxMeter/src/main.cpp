@@ -15,141 +15,736 @@
 #include <Arduino.h>
 #include <U8g2lib.h>
 #include <Wire.h>
+#include <avr/sleep.h>
+
+#include "Journal.h"
+#include "LuxTable.h"
+#include "RingBuffer.h"
+#include "RoundRobin.h"
+#include "Telemetry.h"
 
 #define LED_PIN 2
 #define BUTTON_PIN 3
 
-U8G2_SSD1306_128X32_UNIVISION_F_HW_I2C u8g2(U8G2_R0);
+// two 16-row pages, half the SRAM of a full frame buffer, at the cost of
+// drawing each frame twice
+U8G2_SSD1306_128X32_UNIVISION_2_HW_I2C u8g2(U8G2_R0);
 
 // 1kOhm resistor in voltage divider
 #define KLS6_PIN 0
+
+// Timer1 triggers the ADC at KLS_SAMPLE_RATE and the ISR sums KLS_OVERSAMPLE
+// conversions: 4^3 samples give 3 extra bits, a 13-bit result. The window is
+// 100ms, a whole number of 50Hz and 60Hz mains periods, so lamp flicker
+// averages out.
+#define KLS_OVERSAMPLE 64
+#define KLS_EXTRA_BITS 3
+#define KLS_SAMPLE_RATE 640 // Hz
+
+// A relative change of more than KLS_ACTIVE_THRESHOLD between a window and
+// the smoothed lux makes the meter active: the ADC runs back-to-back windows
+// and history and telemetry are recorded at their fast rates. After
+// KLS_ACTIVE_HOLD ms without such a change it goes steady and, with Timer1
+// paused in between, samples one window every KLS_STEADY_PERIOD ms.
+#define KLS_ACTIVE_THRESHOLD 0.1f
+#define KLS_ACTIVE_HOLD 30000ul // in ms
+#define KLS_STEADY_PERIOD 1000  // in ms
+#define KLS_SMOOTHING_ACTIVE 0.5f
+#define KLS_SMOOTHING_STEADY 0.6f
+
+static volatile uint16_t kls_sum = 0;
+static volatile uint8_t kls_samples = 0;
+static volatile uint16_t kls_result = 0;
+static volatile bool kls_ready = false;
+static volatile bool kls_steady = false;
+
+ISR(ADC_vect) {
+  TIFR1 = _BV(OCF1B); // re-arm the trigger
+  kls_sum += ADC;
+  if (++kls_samples == KLS_OVERSAMPLE) {
+    kls_result = kls_sum >> KLS_EXTRA_BITS;
+    kls_sum = 0;
+    kls_samples = 0;
+    kls_ready = true;
+    if (kls_steady) // pause Timer1 until kls_resume()
+      TCCR1B = _BV(WGM12);
+  }
+}
+
+void kls_start() {
+  ADMUX = _BV(REFS0) | (KLS6_PIN & 0x07); // AVcc reference
+  ADCSRB = _BV(ADTS2) | _BV(ADTS0);       // Timer1 compare match B
+  DIDR0 = _BV(KLS6_PIN);
+  ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) |
+           _BV(ADPS0); // 125kHz ADC clock
+
+  TCCR1A = 0;
+  TCCR1B = _BV(WGM12) | _BV(CS11); // CTC, F_CPU / 8
+  OCR1A = OCR1B = F_CPU / 8 / KLS_SAMPLE_RATE - 1;
+  TCNT1 = 0;
+}
+
+void kls_resume() {
+  TCNT1 = 0;
+  TIFR1 = _BV(OCF1B);
+  TCCR1B = _BV(WGM12) | _BV(CS11);
+}
+
+void adapt(bool active);
+
 static float lux_accumulator = 0.0f;
+static bool kls_active = true; // lets the smoothing settle after boot
+static unsigned long kls_active_ms = 0ul;
 void kls_read() {
-  float Vout = (float)analogRead(KLS6_PIN),
-        Rphoto = 1.0f * (1023.0f - Vout) / Vout,              // in kOhm
-      lux = pow(10.0f, (3.2784f - log10(Rphoto) * 1.63675f)); // from datasheet
-  lux_accumulator = 0.9f * lux_accumulator + 0.1f * lux;
+  noInterrupts();
+  const uint16_t adc = kls_result;
+  kls_ready = false;
+  interrupts();
+  float lux = lux_lookup_fraction(adc, KLS_EXTRA_BITS);
+  // relative to at least 1 lux, so darkness noise doesn't count as change
+  const float change = fabs(lux - lux_accumulator) /
+                       (lux_accumulator > 1.0f ? lux_accumulator : 1.0f);
+  const float smoothing =
+      kls_active ? KLS_SMOOTHING_ACTIVE : KLS_SMOOTHING_STEADY;
+  lux_accumulator = smoothing * lux_accumulator + (1.0f - smoothing) * lux;
+
+  const unsigned long ms = millis();
+  if (change > KLS_ACTIVE_THRESHOLD) {
+    kls_active_ms = ms;
+    if (!kls_active)
+      adapt(true);
+  } else if (kls_active && ms - kls_active_ms >= KLS_ACTIVE_HOLD)
+    adapt(false);
 }
 
+// the lux is recorded every HISTORY_ACTIVE or HISTORY_STEADY ms, and
+// consolidated into the minute tier every HISTORY_TIER s; the graph takes a
+// column per HISTORY_COLUMN s
 #define NHISTORY 98
-static float lux_history[NHISTORY] = {0};
+#define NTIER 24
+#define HISTORY_ACTIVE 1000  // in ms
+#define HISTORY_STEADY 10000 // in ms
+#define HISTORY_TIER 10      // in s
+#define HISTORY_COLUMN 10    // in s
+
+// one frame of up to TELEMETRY_BATCH samples, TELEMETRY_ACTIVE or
+// TELEMETRY_STEADY ms apart; switching sends the partial batch
+#define TELEMETRY_ACTIVE 200  // in ms
+#define TELEMETRY_STEADY 5000 // in ms
+#define TELEMETRY_BATCH 10
+
+static_assert(TELEMETRY_BATCH <= TELEMETRY_BATCH_MAX &&
+                  sizeof(struct TelemetryHeader) + 2 * TELEMETRY_BATCH + 2 <=
+                      SERIAL_TX_BUFFER_SIZE,
+              "telemetry frame must fit the serial transmit buffer");
+
+#define HISTORY_RAW 0
+#define HISTORY_MINUTE 1
+#define HISTORY_HOUR 2
+#define HISTORY_DAY 3
+#define HISTORY_VIEWS 4
+
+static const char history_views[HISTORY_VIEWS][4] PROGMEM = {"10s", "1m",
+                                                             "1h", "1d"};
+
+struct HistoryEntry {
+  uint16_t code;
+  uint8_t delta; // in s since the previous entry, at most 255
+};
+
+// newest first, the newest recorded history_time s after boot; the extrema
+// are only needed when rescaling, so they are scanned for rather than tracked
+static RingBuffer<struct HistoryEntry, NHISTORY> lux_history;
+static unsigned long history_time = 0ul;
+static RoundRobinTier<NTIER, 6> lux_minutes; // 6 x 10s
+static RoundRobinTier<NTIER, 60> lux_hours;  // 60 x 1m
+static RoundRobinTier<NTIER, 24> lux_days;   // 24 x 1h
+
+// the tiers are journalled to EEPROM, behind a 4-byte header, and restored
+// at boot; the minutes get what is left after the hours and days, which take
+// a spare record each
+#define JOURNAL_MAGIC 0x4A4C // "LJ"
+#define JOURNAL_VERSION 1
+#define JOURNAL_HEADER 4
+#define JOURNAL_MINUTES                                                        \
+  ((E2END + 1 - JOURNAL_HEADER - 2 * (NTIER + 1) * JOURNAL_RECORD) /          \
+   JOURNAL_RECORD)
+
+struct JournalHeader {
+  uint16_t magic;
+  uint8_t version;
+  uint8_t minutes;
+};
+
+static Journal<JOURNAL_HEADER, JOURNAL_MINUTES> journal_minutes;
+static Journal<journal_minutes.end, NTIER + 1> journal_hours;
+static Journal<journal_hours.end, NTIER + 1> journal_days;
+
+static_assert(journal_days.end <= E2END + 1, "journal exceeds the EEPROM");
+
+static uint8_t history_view = HISTORY_RAW;
+
+// bar heights in pixels, only rescaled when the shown history changes; the
+// raw history takes a column per HISTORY_COLUMN s, the max of its entries or
+// 0 without any, and for the tiers each slot takes three: min, mean, max
+static uint8_t history_bars[NHISTORY];
+static uint8_t history_len = 0;
+static uint16_t history_min = 0, history_max = 0;
+static bool history_dirty = true;
+
+// steps from entry i to the one before it, back to uptime t, and returns the
+// number of graph columns, aligned to HISTORY_COLUMN s of uptime and starting
+// at start, that takes
+uint8_t history_step(uint8_t i, unsigned long &t, unsigned long &start) {
+  t -= lux_history[i].delta;
+  uint8_t columns = 0;
+  for (; start > t; ++columns)
+    start -= HISTORY_COLUMN;
+  return columns;
+}
+
+// Called before history_time moves on to the new entry. Once full, the ring
+// would drop its oldest entry, and under sustained activity the graph would
+// shrink to NHISTORY s. Instead, the oldest two entries that share a column
+// are merged into one with their max, which leaves the graph as it was; only
+// when every entry has a column of its own does the oldest go.
+void history_record(uint16_t code, uint8_t delta) {
+  if (lux_history.size() == NHISTORY) {
+    unsigned long t = history_time, start = t - t % HISTORY_COLUMN;
+    uint8_t pair = NHISTORY;
+    for (uint8_t i = 0; i + 1 < lux_history.size(); i++)
+      if (history_step(i, t, start) == 0)
+        pair = i;
+    if (pair < NHISTORY) {
+      struct HistoryEntry &newer = lux_history[pair];
+      const struct HistoryEntry older = lux_history[pair + 1];
+      if (older.code > newer.code)
+        newer.code = older.code;
+      newer.delta = newer.delta + older.delta > 255 ? 255
+                                                    : newer.delta + older.delta;
+      lux_history.erase(pair + 1);
+    }
+  }
+  lux_history.push({code, delta});
+  history_dirty |= history_view == HISTORY_RAW;
+}
+
+// runs every HISTORY_ACTIVE or HISTORY_STEADY ms, as set by adapt()
 void history() {
-  memmove((void *)&(lux_history[1]), lux_history,
-          (NHISTORY - 1) * sizeof(float));
-  lux_history[0] = lux_accumulator;
+  static uint8_t seconds = 0;
+  static uint16_t lo, hi;
+  static float sum = 0.0f;
+
+  const uint16_t code = lux_encode(lux_accumulator);
+  const unsigned long now = millis() / 1000ul;
+  const unsigned long elapsed = now - history_time;
+  history_record(code, elapsed > 255ul ? 255 : elapsed);
+  history_time = now;
+
+  // the tiers weigh each recording by the seconds it stands for; one that
+  // straddles the end of a slot counts toward the next as well
+  const uint8_t weight = elapsed < HISTORY_TIER ? elapsed : HISTORY_TIER;
+  if (seconds == 0 || code < lo)
+    lo = code;
+  if (seconds == 0 || code > hi)
+    hi = code;
+  sum += lux_accumulator * weight;
+  seconds += weight;
+  if (seconds < HISTORY_TIER)
+    return;
+  const uint8_t over = seconds - HISTORY_TIER;
+  const uint16_t min = lo, max = hi,
+                 mean = lux_encode((sum - lux_accumulator * over) /
+                                   HISTORY_TIER);
+  seconds = over;
+  sum = lux_accumulator * over; // the part that starts the next slot
+  lo = hi = code;
+
+  if (!lux_minutes.add(min, mean, max))
+    return;
+  history_dirty |= history_view == HISTORY_MINUTE;
+  const RoundRobinSlot &m = lux_minutes[0];
+  journal_minutes.append(m);
+  if (!lux_hours.add(m.min, m.mean, m.max))
+    return;
+  history_dirty |= history_view == HISTORY_HOUR;
+  const RoundRobinSlot &h = lux_hours[0];
+  journal_hours.append(h);
+  if (!lux_days.add(h.min, h.mean, h.max))
+    return;
+  history_dirty |= history_view == HISTORY_DAY;
+  journal_days.append(lux_days[0]);
 }
 
-void setup() {
-  delay(3000);
+// bounded by reading the EEPROM at most three times over, well under 10ms
+void history_restore() {
+  const struct JournalHeader expected = {JOURNAL_MAGIC, JOURNAL_VERSION,
+                                         JOURNAL_MINUTES};
+  struct JournalHeader header;
+  eeprom_read_block(&header, (const void *)0, sizeof(header));
+  if (memcmp(&header, &expected, sizeof(header)) != 0) {
+    // first boot or a different layout
+    journal_minutes.format();
+    journal_hours.format();
+    journal_days.format();
+    eeprom_update_block(&expected, (void *)0, sizeof(expected));
+    return;
+  }
+  journal_minutes.restore(lux_minutes);
+  journal_hours.restore(lux_hours);
+  journal_days.restore(lux_days);
+}
 
-  u8g2.begin();
-  u8g2.setContrast(0x00);
+bool journal_pending() {
+  return (journal_minutes.busy() || journal_hours.busy() ||
+          journal_days.busy()) &&
+         eeprom_is_ready();
+}
 
-  Serial.begin(115200);
+// one byte per run, so the scheduler never waits on the EEPROM
+void journal_task() {
+  if (journal_minutes.busy())
+    journal_minutes.write();
+  else if (journal_hours.busy())
+    journal_hours.write();
+  else
+    journal_days.write();
+}
 
-  pinMode(LED_BUILTIN, OUTPUT);
-  digitalWrite(LED_BUILTIN, LOW);
+uint8_t history_height(uint16_t code, float lux_min, float range) {
+  return 1 + (range > 0.0f
+                  ? (uint8_t)(15.0f * (lux_decode(code) - lux_min) / range)
+                  : 0);
+}
 
-  pinMode(LED_PIN, OUTPUT);
-  digitalWrite(LED_PIN, LOW);
+template <typename Tier> void history_scale_tier(const Tier &tier) {
+  history_min = tier.min();
+  history_max = tier.max();
+  const float lux_min = lux_decode(history_min),
+              range = lux_decode(history_max) - lux_min;
+  history_len = tier.size();
+  for (uint8_t i = 0; i < history_len; i++) {
+    history_bars[3 * i] = history_height(tier[i].min, lux_min, range);
+    history_bars[3 * i + 1] = history_height(tier[i].mean, lux_min, range);
+    history_bars[3 * i + 2] = history_height(tier[i].max, lux_min, range);
+  }
+}
 
-  pinMode(BUTTON_PIN, INPUT_PULLUP);
+void history_scale() {
+  switch (history_view) {
+  case HISTORY_RAW: {
+    // column 0 holds the newest entry; min and max are those of the entries
+    // shown, which the first walk counts
+    unsigned long t = history_time, start = t - t % HISTORY_COLUMN;
+    uint8_t shown = 0, column = 0;
+    history_min = 0xFFFF;
+    history_max = 0;
+    for (; shown < lux_history.size(); shown++) {
+      if (shown && (column += history_step(shown - 1, t, start)) >= NHISTORY)
+        break;
+      const uint16_t code = lux_history[shown].code;
+      if (code < history_min)
+        history_min = code;
+      if (code > history_max)
+        history_max = code;
+    }
+    if (!shown)
+      history_min = 0;
+    const float lux_min = lux_decode(history_min),
+                range = lux_decode(history_max) - lux_min;
+    memset(history_bars, 0, sizeof(history_bars));
+    t = history_time;
+    start = t - t % HISTORY_COLUMN;
+    column = 0;
+    for (uint8_t i = 0; i < shown; i++) {
+      if (i)
+        column += history_step(i - 1, t, start);
+      const uint8_t height =
+          history_height(lux_history[i].code, lux_min, range);
+      if (height > history_bars[column])
+        history_bars[column] = height;
+    }
+    history_len = shown ? column + 1 : 0;
+  } break;
+  case HISTORY_MINUTE:
+    history_scale_tier(lux_minutes);
+    break;
+  case HISTORY_HOUR:
+    history_scale_tier(lux_hours);
+    break;
+  case HISTORY_DAY:
+    history_scale_tier(lux_days);
+  }
+  history_dirty = false;
+}
+
+void history_draw() {
+  if (history_view == HISTORY_RAW) {
+    for (uint8_t i = 0; i < history_len; i++)
+      u8g2.drawVLine(i, 32 - history_bars[i], history_bars[i]);
+    return;
+  }
+  // mean as a bar with the min-max range as a whisker to its right
+  for (uint8_t i = 0; i < history_len; i++) {
+    const uint8_t *bar = &history_bars[3 * i];
+    u8g2.drawBox(4 * i, 32 - bar[1], 3, bar[1]);
+    u8g2.drawVLine(4 * i + 3, 32 - bar[2], bar[2] - bar[0] + 1);
+  }
 }
 
 static unsigned oled_accumulator = 0ul;
 
 void draw() {
+  if (history_dirty)
+    history_scale();
 
-  u8g2.clearBuffer();
-  u8g2.setFont(u8g2_font_inr16_mr);
-  unsigned int len = u8g2.drawStr(0, 15, "LUX");
-  u8g2.setFont(u8g2_font_5x8_tf);
-  char flt[11];
-  snprintf(flt, 7, "%6lu", (unsigned long)lux_accumulator);
-  u8g2.drawStr(98, 30, flt);
-  if (oled_accumulator >= 500ul)
-    u8g2.drawDisc(118, 9, 8, U8G2_DRAW_UPPER_RIGHT | U8G2_DRAW_LOWER_LEFT);
-  else
-    u8g2.drawDisc(118, 9, 8, U8G2_DRAW_UPPER_LEFT | U8G2_DRAW_LOWER_RIGHT);
-  u8g2.drawCircle(118, 9, 9);
-  float lux_max = lux_history[0], lux_min = lux_history[0];
-  for (unsigned int i = 1; i < NHISTORY; i++) {
-    if (lux_history[i] > lux_max)
-      lux_max = lux_history[i];
-    if (lux_history[i] < lux_min)
-      lux_min = lux_history[i];
-  }
-  for (unsigned int i = 0; i < NHISTORY; i++) {
-    int value =
-        1 + (int)(15.0 * (lux_history[i] - lux_min) / (lux_max - lux_min));
-    u8g2.drawVLine(i, 32 - value, value);
-  }
-  snprintf(flt, 10, "max: %-5lu", (unsigned long)lux_max);
-  u8g2.drawStr(len + 2, 6, flt);
-  snprintf(flt, 10, "min: %-5lu", (unsigned long)lux_min);
-  u8g2.drawStr(len + 2, 15, flt);
+  // formatted once, as every page draws them
+  char lux[7], max[16], min[16], view[sizeof(history_views[0])];
+  snprintf_P(lux, sizeof(lux), PSTR("%6lu"), (unsigned long)lux_accumulator);
+  snprintf_P(max, sizeof(max), PSTR("max: %-5lu"),
+             (unsigned long)lux_decode(history_max));
+  snprintf_P(min, sizeof(min), PSTR("min: %-5lu"),
+             (unsigned long)lux_decode(history_min));
+  strcpy_P(view, history_views[history_view]);
 
-  u8g2.sendBuffer();
+  u8g2.firstPage();
+  do {
+    u8g2.setFont(u8g2_font_inr16_mr);
+    unsigned int len = u8g2.drawStr(0, 15, "LUX");
+    u8g2.setFont(u8g2_font_5x8_tf);
+    u8g2.drawStr(98, 30, lux);
+    if (oled_accumulator >= 500ul)
+      u8g2.drawDisc(118, 9, 8, U8G2_DRAW_UPPER_RIGHT | U8G2_DRAW_LOWER_LEFT);
+    else
+      u8g2.drawDisc(118, 9, 8, U8G2_DRAW_UPPER_LEFT | U8G2_DRAW_LOWER_RIGHT);
+    u8g2.drawCircle(118, 9, 9);
+    history_draw();
+    u8g2.drawStr(len + 2, 6, max);
+    u8g2.drawStr(len + 2, 15, min);
+    u8g2.setFont(u8g2_font_4x6_tf);
+    u8g2.drawStr(96, 6, view);
+  } while (u8g2.nextPage());
 }
 
-bool led_state = false;
-bool led_flash = false;
 bool screen_state = false;
 
-static unsigned long oled_timer = 0ul;
-static unsigned long serial_timer = 0ul;
-static unsigned long led_timer = 0ul;
-static unsigned long button_timer = 0ul;
-static unsigned long kls_timer = 0ul;
-static unsigned long history_timer = 0ul;
-
-void loop() {
+void draw_task() {
+  static unsigned long timer = millis();
   unsigned long ms = millis();
-  if ((ms - oled_timer) > 40ul) {
-    oled_accumulator += (ms - oled_timer);
+  oled_accumulator += ms - timer;
+  if (oled_accumulator >= 1000ul)
+    oled_accumulator %= 1000ul;
+  timer = ms;
+  if (!screen_state) // powered down, nothing to refresh
     draw();
-    if (oled_accumulator >= 1000ul)
-      oled_accumulator = oled_accumulator - 1000ul;
-    oled_timer = ms;
-  }
+}
+
+void telemetry_task();
+void led_task();
+void button_task();
+void command_task();
+bool kls_pending() { return kls_ready; }
+bool serial_pending() { return Serial.available() > 0; }
+
+static volatile bool button_pressed = false;
+void button_isr() { button_pressed = true; }
+bool button_pending() { return button_pressed; }
+
+// A task runs when its deadline passes, or, when it has a pending() check,
+// whenever that returns true. Periodic tasks re-arm themselves, one-shots
+// (interval 0) are armed with task_arm().
+struct Task {
+  void (*run)();
+  bool (*pending)();
+  uint16_t interval; // in ms
+  bool armed;
+  unsigned long due; // in ms
+};
+
+// Run time and lateness, how long after its deadline a task started, take 16
+// bytes of SRAM per task, so they are only kept when SCHEDULER_STATS is set,
+// e.g., by the simulator.
+#ifndef SCHEDULER_STATS
+#define SCHEDULER_STATS 0
+#endif
+
+#if SCHEDULER_STATS
+struct TaskStats {
+  unsigned long runs;
+  unsigned long busy_us;
+  uint16_t busy_max_us;
+  uint16_t late_max_ms;
+  unsigned long late_ms;
+};
+#endif
+
+#define TASK_DRAW 0
+#define TASK_TELEMETRY 1
+#define TASK_LED 2
+#define TASK_BUTTON 3
+#define TASK_KLS 4
+#define TASK_HISTORY 5
+#define TASK_COMMAND 6
+#define TASK_JOURNAL 7
+#define TASK_RESUME 8
+#define TASK_NUMBER 9
+
+static struct Task tasks[TASK_NUMBER] = {
+    {draw_task, nullptr, 40, true, 0ul},
+    {telemetry_task, nullptr, TELEMETRY_ACTIVE, true, 0ul},
+    {led_task, nullptr, 0, false, 0ul},
+    {button_task, button_pending, 0, false, 0ul},
+    {kls_read, kls_pending, 0, false, 0ul},
+    {history, nullptr, HISTORY_ACTIVE, true, 0ul},
+    {command_task, serial_pending, 0, false, 0ul},
+    {journal_task, journal_pending, 0, false, 0ul},
+    {kls_resume, nullptr, KLS_STEADY_PERIOD, false, 0ul}};
+
+#if SCHEDULER_STATS
+static struct TaskStats task_stats[TASK_NUMBER];
+
+static const char task_names[TASK_NUMBER][10] PROGMEM = {
+    "draw",    "telemetry", "led",     "button", "kls",
+    "history", "command",   "journal", "resume"};
+#endif
+
+static unsigned long scheduler_idle_us = 0ul;
+static unsigned long scheduler_start_us = 0ul;
+
+void task_arm(uint8_t id, uint16_t delay_ms) {
+  tasks[id].due = millis() + delay_ms;
+  tasks[id].armed = true;
+}
 
-  ms = millis();
-  if ((ms - serial_timer) > 10000ul) {
-    const unsigned long lux = (unsigned long)lux_accumulator;
-    Serial.write((char *)&lux, sizeof(unsigned long)); // uint32_t
-    led_flash = true;
-    serial_timer = ms;
+void task_run(uint8_t id, unsigned long now) {
+  struct Task &task = tasks[id];
+#if SCHEDULER_STATS
+  struct TaskStats &stats = task_stats[id];
+#endif
+  if (task.armed) {
+#if SCHEDULER_STATS
+    unsigned long late = now - task.due;
+    stats.late_ms += late;
+    if (late > stats.late_max_ms)
+      stats.late_max_ms = late > 0xFFFFul ? 0xFFFF : late;
+#endif
+    if (task.interval) {
+      task.due += task.interval;
+      if ((long)(now - task.due) >= 0) // fell behind, don't burst
+        task.due = now + task.interval;
+    } else
+      task.armed = false;
   }
+#if SCHEDULER_STATS
+  unsigned long us = micros();
+  task.run();
+  us = micros() - us;
+  stats.busy_us += us;
+  if (us > stats.busy_max_us)
+    stats.busy_max_us = us > 0xFFFFul ? 0xFFFF : us;
+  ++stats.runs;
+#else
+  task.run();
+#endif
+}
+
+void scheduler_start() {
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < TASK_NUMBER; i++)
+    tasks[i].due = now + tasks[i].interval;
+  scheduler_start_us = micros();
+}
 
-  ms = millis();
-  if (led_flash && (ms - led_timer) > 50ul) {
-    if (!led_state) {
-      digitalWrite(LED_PIN, HIGH);
-      led_state = true;
-    } else {
-      digitalWrite(LED_PIN, LOW);
-      led_state = false;
-      led_flash = false;
+void scheduler_loop() {
+  bool ran = false;
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < TASK_NUMBER; i++) {
+    struct Task &task = tasks[i];
+    if ((task.pending && task.pending()) ||
+        (task.armed && (long)(now - task.due) >= 0)) {
+      task_run(i, now);
+      ran = true;
+      now = millis();
     }
-    led_timer = ms;
   }
 
-  ms = millis();
-  if (digitalRead(BUTTON_PIN) == LOW && (ms - button_timer) > 500ul) {
-    screen_state = !screen_state;
-    u8g2.setPowerSave(screen_state);
-    button_timer = ms;
+  if (ran)
+    return;
+
+  // nothing due: idle until the next interrupt, which is at the latest the
+  // 1ms Timer0 tick that keeps millis() and thus the deadlines running
+  unsigned long us = micros();
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  cli();
+  if (!button_pressed && !kls_ready) {
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
   }
+  sei();
+  scheduler_idle_us += micros() - us;
+}
 
-  ms = millis();
-  if ((ms - kls_timer) > 200ul) {
-    kls_read();
-    kls_timer = ms;
+// the idle time is always kept, the per-task table needs SCHEDULER_STATS
+void scheduler_report(Stream &str) {
+  char buf[64];
+#if SCHEDULER_STATS
+  char name[sizeof(task_names[0])];
+  str.println(F("task      runs    busy(us) max(us) late(ms) max(ms)"));
+  for (uint8_t i = 0; i < TASK_NUMBER; i++) {
+    const struct TaskStats &stats = task_stats[i];
+    strcpy_P(name, task_names[i]);
+    snprintf_P(buf, sizeof(buf), PSTR("%-9s %7lu %10lu %6u %8lu %6u"), name,
+               stats.runs, stats.busy_us, stats.busy_max_us, stats.late_ms,
+               stats.late_max_ms);
+    str.println(buf);
   }
+#endif
+  unsigned long total = micros() - scheduler_start_us;
+  snprintf_P(buf, sizeof(buf), PSTR("idle %lu of %lu us (%u%%)"),
+             scheduler_idle_us, total,
+             (unsigned)(100.0f * scheduler_idle_us / total));
+  str.println(buf);
+#ifdef __AVR__
+  // between the heap, unused here, and this deepest point of the stack
+  extern char __heap_start, *__brkval;
+  char top;
+  snprintf_P(buf, sizeof(buf), PSTR("free %u bytes of SRAM"),
+             (unsigned)(&top - (__brkval ? __brkval : &__heap_start)));
+  str.println(buf);
+#endif
+
+  // statistics cover the interval between reports, which keeps the 32-bit
+  // microsecond counters from wrapping
+#if SCHEDULER_STATS
+  memset(task_stats, 0, sizeof(task_stats));
+#endif
+  scheduler_idle_us = 0ul;
+  scheduler_start_us = micros();
+}
 
-  ms = millis();
-  if ((ms - history_timer) > 10000ul) {
-    history();
-    history_timer = ms;
+static struct {
+  struct TelemetryHeader hdr;
+  uint16_t samples[TELEMETRY_BATCH];
+} telemetry = {{{TELEMETRY_SYNC0, TELEMETRY_SYNC1},
+                TELEMETRY_VERSION,
+                0,
+                0,
+                TELEMETRY_ACTIVE,
+                0ul},
+               {0}};
+
+// The sketch's tables take 1032 of the Uno's 2048 bytes of SRAM. With the
+// libraries' ~730 bytes and the remaining statics, that leaves ~225 bytes for
+// the stack; see the README before growing any of them.
+#define SRAM_TABLES 1032
+#ifdef __AVR__
+static_assert(sizeof(lux_history) + sizeof(lux_minutes) + sizeof(lux_hours) +
+                      sizeof(lux_days) + sizeof(journal_minutes) +
+                      sizeof(journal_hours) + sizeof(journal_days) +
+                      sizeof(history_bars) + sizeof(tasks) +
+                      sizeof(telemetry) <=
+                  SRAM_TABLES,
+              "tables exceed their share of the SRAM budget");
+#endif
+
+void telemetry_send() {
+  if (telemetry.hdr.count == 0)
+    return;
+
+  const size_t len =
+      sizeof(struct TelemetryHeader) + telemetry.hdr.count * sizeof(uint16_t);
+  const uint16_t crc =
+      telemetry_crc16(0, (const uint8_t *)&telemetry + 2, len - 2);
+  Serial.write((const uint8_t *)&telemetry, len);
+  Serial.write((const uint8_t *)&crc, sizeof(crc));
+
+  ++telemetry.hdr.seq;
+  telemetry.hdr.count = 0;
+
+  digitalWrite(LED_PIN, HIGH);
+  task_arm(TASK_LED, 50);
+}
+
+void telemetry_task() {
+  if (telemetry.hdr.count == 0) {
+    telemetry.hdr.timestamp = millis();
+    telemetry.hdr.interval = tasks[TASK_TELEMETRY].interval;
   }
-}
\ No newline at end of file
+  telemetry.samples[telemetry.hdr.count++] = lux_encode(lux_accumulator);
+  if (telemetry.hdr.count == TELEMETRY_BATCH)
+    telemetry_send();
+}
+
+// switches between the active and steady rates; a frame holds samples of a
+// single interval, so the partial batch goes out first
+void adapt(bool active) {
+  kls_active = active;
+  kls_steady = !active;
+  telemetry_send();
+  tasks[TASK_TELEMETRY].interval = active ? TELEMETRY_ACTIVE : TELEMETRY_STEADY;
+  tasks[TASK_HISTORY].interval = active ? HISTORY_ACTIVE : HISTORY_STEADY;
+  if (active) { // record the change right away
+    tasks[TASK_RESUME].armed = false;
+    kls_resume();
+    task_arm(TASK_TELEMETRY, 0);
+    task_arm(TASK_HISTORY, 0);
+  } else {
+    task_arm(TASK_RESUME, KLS_STEADY_PERIOD);
+    task_arm(TASK_TELEMETRY, TELEMETRY_STEADY);
+    task_arm(TASK_HISTORY, HISTORY_STEADY);
+  }
+}
+
+void led_task() { digitalWrite(LED_PIN, LOW); }
+
+void button_task() {
+  static unsigned long button_timer = 0ul;
+  button_pressed = false;
+  unsigned long ms = millis();
+  if ((ms - button_timer) <= 500ul) // debounce
+    return;
+  // cycles through the history views, then turns the screen off
+  if (screen_state) {
+    screen_state = false;
+    history_view = HISTORY_RAW;
+  } else if (history_view + 1 == HISTORY_VIEWS)
+    screen_state = true;
+  else
+    ++history_view;
+  u8g2.setPowerSave(screen_state);
+  history_dirty = true;
+  button_timer = ms;
+}
+
+void command_task() {
+  if (Serial.read() == 'S')
+    scheduler_report(Serial);
+}
+
+void setup() {
+  delay(3000);
+
+  u8g2.begin();
+  u8g2.setContrast(0x00);
+
+  Serial.begin(115200);
+
+  pinMode(LED_BUILTIN, OUTPUT);
+  digitalWrite(LED_BUILTIN, LOW);
+
+  pinMode(LED_PIN, OUTPUT);
+  digitalWrite(LED_PIN, LOW);
+
+  pinMode(BUTTON_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(BUTTON_PIN), button_isr, FALLING);
+
+  history_restore();
+
+  kls_start();
+
+  scheduler_start();
+}
+
+void loop() { scheduler_loop(); }
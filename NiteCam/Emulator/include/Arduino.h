@@ -0,0 +1,161 @@
+/**
+ *  @file    Arduino.h
+ *  @brief   Host Stand-In for the ESP8266 Arduino Core
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *  @details The clock runs at a multiple of real time, emulator_speed, so a
+ *           benchmark takes less than the transfers it models; the camera
+ *           emulator paces its bytes by the same clock. Serial is a pseudo
+ *           terminal with a receive buffer of the size the firmware sets,
+ *           which drops what does not fit.
+ *
+ ***********************************************/
+
+#ifndef EMULATOR_ARDUINO_H
+#define EMULATOR_ARDUINO_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+#define _min(a, b) ((a) < (b) ? (a) : (b))
+#define _max(a, b) ((a) > (b) ? (a) : (b))
+
+inline const std::chrono::steady_clock::time_point emulator_epoch =
+    std::chrono::steady_clock::now();
+
+inline double emulator_speed = 1.0; // virtual over real time
+
+inline double emulator_ms() {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - emulator_epoch)
+             .count() *
+         emulator_speed;
+}
+
+inline unsigned long micros() { return emulator_ms() * 1000.0; }
+
+inline unsigned long millis() { return emulator_ms(); }
+
+inline void delay(unsigned long ms) {
+  std::this_thread::sleep_for(
+      std::chrono::duration<double, std::milli>(ms / emulator_speed));
+}
+
+inline void yield() { std::this_thread::yield(); }
+
+class String {
+public:
+  String() {}
+  String(const char *s) : s(s) {}
+  String(const std::string &s) : s(s) {}
+
+  const char *c_str() const { return s.c_str(); }
+  unsigned int length() const { return s.size(); }
+  long toInt() const { return std::atol(s.c_str()); }
+  float toFloat() const { return std::atof(s.c_str()); }
+
+  bool operator==(const char *o) const { return s == o; }
+  bool operator!=(const char *o) const { return s != o; }
+  bool operator==(const String &o) const { return s == o.s; }
+  bool operator!=(const String &o) const { return s != o.s; }
+
+private:
+  std::string s;
+};
+
+// the UART, with fd the firmware's end of a pseudo terminal; bytes are moved
+// into the receive buffer whenever the firmware looks at it
+class HardwareSerial {
+public:
+  int fd = -1;
+  std::atomic<long> baud{0}; // read by the camera emulator
+  size_t rx_size = 256;
+  size_t rx_dropped = 0; // for a full receive buffer
+  unsigned long timeout = 1000;
+
+  void begin(long b) { baud = b; }
+  void updateBaudRate(long b) { baud = b; }
+  void setRxBufferSize(size_t n) { rx_size = n; }
+  void setTimeout(unsigned long ms) { timeout = ms; }
+  void flush() {}
+
+  int available() {
+    pull();
+    return rx.size();
+  }
+
+  int read() {
+    pull();
+    if (rx.empty())
+      return -1;
+    const int c = rx.front();
+    rx.pop_front();
+    return c;
+  }
+
+  // waits up to the timeout for len bytes
+  size_t readBytes(uint8_t *buf, size_t len) {
+    const unsigned long start = millis();
+    size_t n = 0;
+    while (n < len) {
+      const int c = read();
+      if (c >= 0) {
+        buf[n++] = c;
+        continue;
+      }
+      if (millis() - start >= timeout)
+        break;
+      yield();
+    }
+    return n;
+  }
+
+  size_t readBytes(char *buf, size_t len) {
+    return readBytes((uint8_t *)buf, len);
+  }
+
+  size_t write(const uint8_t *buf, size_t len) {
+    return fd < 0 || ::write(fd, buf, len) < 0 ? 0 : len;
+  }
+
+  size_t write(uint8_t c) { return write(&c, 1); }
+
+private:
+  std::deque<uint8_t> rx;
+
+  void pull() {
+    uint8_t buf[256];
+    ssize_t n;
+    while (fd >= 0 && (n = ::read(fd, buf, sizeof(buf))) > 0)
+      for (ssize_t i = 0; i < n; i++) {
+        if (rx.size() < rx_size)
+          rx.push_back(buf[i]);
+        else
+          ++rx_dropped;
+      }
+  }
+};
+
+inline HardwareSerial Serial;
+
+class EspClass {
+public:
+  uint32_t getFreeHeap() { return 0; }
+  uint32_t getMaxFreeBlockSize() { return 0; }
+  uint8_t getHeapFragmentation() { return 0; }
+  [[noreturn]] void restart() { std::exit(1); }
+};
+
+inline EspClass ESP;
+
+#endif // EMULATOR_ARDUINO_H
@@ -0,0 +1,41 @@
+/**
+ *  @file    ArduinoOTA.h
+ *  @brief   Host Stand-In for ArduinoOTA
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *
+ ***********************************************/
+
+#ifndef EMULATOR_ARDUINOOTA_H
+#define EMULATOR_ARDUINOOTA_H
+
+#include <functional>
+
+#define U_FLASH 0
+#define U_FS 100
+
+typedef enum {
+  OTA_AUTH_ERROR,
+  OTA_BEGIN_ERROR,
+  OTA_CONNECT_ERROR,
+  OTA_RECEIVE_ERROR,
+  OTA_END_ERROR
+} ota_error_t;
+
+// never receives an update
+class ArduinoOTAClass {
+public:
+  void setHostname(const char *) {}
+  void onStart(std::function<void()>) {}
+  void onEnd(std::function<void()>) {}
+  void onProgress(std::function<void(unsigned int, unsigned int)>) {}
+  void onError(std::function<void(ota_error_t)>) {}
+  void begin() {}
+  void handle() {}
+  int getCommand() { return U_FLASH; }
+};
+
+inline ArduinoOTAClass ArduinoOTA;
+
+#endif // EMULATOR_ARDUINOOTA_H
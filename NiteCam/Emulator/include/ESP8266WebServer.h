@@ -0,0 +1,112 @@
+/**
+ *  @file    ESP8266WebServer.h
+ *  @brief   Host Stand-In for ESP8266WebServer
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *  @details Takes no connections: the emulator passes requests to request(),
+ *           which runs the handler for the path with a new client sink and
+ *           returns that client. A response sent through the server closes
+ *           the client; one the firmware keeps is left open.
+ *
+ ***********************************************/
+
+#ifndef EMULATOR_ESP8266WEBSERVER_H
+#define EMULATOR_ESP8266WEBSERVER_H
+
+#include <ESP8266WiFi.h>
+
+#include <functional>
+#include <map>
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t)-1)
+
+class ESP8266WebServer {
+public:
+  explicit ESP8266WebServer(int) {}
+
+  void on(const char *uri, std::function<void()> handler) {
+    handlers[uri] = handler;
+  }
+  void onNotFound(std::function<void()> handler) { not_found = handler; }
+  void collectHeaders(const char **, size_t) {}
+  void begin() {}
+  void handleClient() {}
+
+  // runs the handler for a path, with its query, e.g., "/?size=160x120"
+  WiFiClient request(const std::string &uri,
+                     const std::map<std::string, std::string> &headers = {}) {
+    const size_t q = uri.find('?');
+    const std::string path = uri.substr(0, q);
+    args.clear();
+    if (q != std::string::npos) {
+      std::string query = uri.substr(q + 1);
+      while (!query.empty()) {
+        const size_t amp = query.find('&'), eq = query.find('=');
+        const std::string arg = query.substr(0, amp);
+        if (eq < amp)
+          args[arg.substr(0, eq)] = arg.substr(eq + 1);
+        else
+          args[arg] = "";
+        query = amp == std::string::npos ? "" : query.substr(amp + 1);
+      }
+    }
+    this->headers = headers;
+    current = WiFiClient(std::make_shared<ClientSink>());
+    sent = false;
+    extra.clear();
+    length = 0;
+    auto h = handlers.find(path);
+    if (h != handlers.end())
+      h->second();
+    else if (not_found)
+      not_found();
+    if (sent)
+      current.stop();
+    return current;
+  }
+
+  bool hasArg(const char *name) { return args.count(name); }
+  String arg(const char *name) {
+    auto a = args.find(name);
+    return a == args.end() ? String() : String(a->second);
+  }
+  String header(const char *name) {
+    auto h = headers.find(name);
+    return h == headers.end() ? String() : String(h->second);
+  }
+
+  WiFiClient client() { return current; }
+
+  void sendHeader(const char *name, const char *value) {
+    extra += std::string(name) + ": " + value + "\r\n";
+  }
+
+  void setContentLength(size_t len) { length = len; }
+
+  void send(int code, const char *type, const char *body) {
+    std::string res = "HTTP/1.1 " + std::to_string(code) +
+                      "\r\nContent-Type: " + type + "\r\n" + extra;
+    if (length != CONTENT_LENGTH_UNKNOWN)
+      res += "Content-Length: " + std::to_string(strlen(body)) + "\r\n";
+    res += "Connection: close\r\n\r\n";
+    res += body;
+    current.print(res.c_str());
+    sent = true;
+  }
+
+  void sendContent(const char *content, size_t len) {
+    current.print(std::string(content, len).c_str());
+  }
+
+private:
+  std::map<std::string, std::function<void()>> handlers;
+  std::function<void()> not_found;
+  std::map<std::string, std::string> args, headers;
+  WiFiClient current;
+  std::string extra;
+  size_t length = 0;
+  bool sent = false;
+};
+
+#endif // EMULATOR_ESP8266WEBSERVER_H
@@ -0,0 +1,95 @@
+/**
+ *  @file    ESP8266WiFi.h
+ *  @brief   Host Stand-In for ESP8266WiFi
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *  @details A client is a sink that keeps what it is sent. Its TCP send
+ *           buffer of TCP_SND_BUF bytes drains at wifi_bytes_per_ms, so
+ *           availableForWrite() shrinks and recovers as on the ESP8266.
+ *
+ ***********************************************/
+
+#ifndef EMULATOR_ESP8266WIFI_H
+#define EMULATOR_ESP8266WIFI_H
+
+#include <Arduino.h>
+#include <lwip/opt.h>
+
+#include <memory>
+
+#define WL_CONNECTED 3
+
+inline double wifi_bytes_per_ms = 1000.0; // virtual
+
+struct ClientSink {
+  std::string data; // all that was sent
+  bool connected = true;
+  size_t queued = 0; // in the send buffer
+  double drained_ms = emulator_ms();
+  unsigned long opened_ms = millis();
+  unsigned long closed_ms = 0;
+
+  void drain() {
+    const double ms = emulator_ms();
+    const double n = (ms - drained_ms) * wifi_bytes_per_ms;
+    queued = n >= queued ? 0 : queued - (size_t)n;
+    drained_ms = ms;
+  }
+};
+
+class WiFiClient {
+public:
+  WiFiClient() {}
+  explicit WiFiClient(std::shared_ptr<ClientSink> sink) : sink(sink) {}
+
+  uint8_t connected() { return sink && sink->connected; }
+
+  int availableForWrite() {
+    if (!connected())
+      return 0;
+    sink->drain();
+    return sink->queued >= TCP_SND_BUF ? 0 : TCP_SND_BUF - sink->queued;
+  }
+
+  size_t write(const uint8_t *buf, size_t len) {
+    const size_t n = _min(len, (size_t)availableForWrite());
+    if (n) {
+      sink->data.append((const char *)buf, n);
+      sink->queued += n;
+    }
+    return n;
+  }
+
+  // blocks on the ESP8266 until all is taken, so is never cut short here
+  size_t print(const char *s) {
+    if (!connected())
+      return 0;
+    sink->drain();
+    sink->data += s;
+    sink->queued += strlen(s);
+    return strlen(s);
+  }
+
+  void stop() {
+    if (!connected())
+      return;
+    sink->connected = false;
+    sink->closed_ms = millis();
+  }
+
+  void setNoDelay(bool) {}
+
+  std::shared_ptr<ClientSink> sink;
+};
+
+class ESP8266WiFiClass {
+public:
+  bool hostname(const char *) { return true; }
+  int begin(const char *, const char *) { return WL_CONNECTED; }
+  int waitForConnectResult() { return WL_CONNECTED; }
+};
+
+inline ESP8266WiFiClass WiFi;
+
+#endif // EMULATOR_ESP8266WIFI_H
@@ -0,0 +1,13 @@
+/**
+ *  @file    ESP8266mDNS.h
+ *  @brief   Host Stand-In for ESP8266mDNS
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *
+ ***********************************************/
+
+#ifndef EMULATOR_ESP8266MDNS_H
+#define EMULATOR_ESP8266MDNS_H
+
+#endif // EMULATOR_ESP8266MDNS_H
@@ -0,0 +1,144 @@
+/**
+ *  @file    LittleFS.h
+ *  @brief   Host Stand-In for LittleFS
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *  @details Keeps the file system in a local directory, root, which
+ *           persists between runs like the flash does between reboots.
+ *           Space is counted in 4kB blocks out of a capacity of size bytes.
+ *
+ ***********************************************/
+
+#ifndef EMULATOR_LITTLEFS_H
+#define EMULATOR_LITTLEFS_H
+
+#include <Arduino.h>
+
+#include <filesystem>
+#include <memory>
+
+struct FSInfo {
+  size_t totalBytes;
+  size_t usedBytes;
+  size_t blockSize;
+  size_t pageSize;
+  size_t maxOpenFiles;
+  size_t maxPathLength;
+};
+
+class File {
+public:
+  File() {}
+  explicit File(std::FILE *f) {
+    if (f)
+      this->f.reset(f, std::fclose);
+  }
+
+  explicit operator bool() const { return (bool)f; }
+
+  size_t read(uint8_t *buf, size_t len) {
+    return f ? std::fread(buf, 1, len, f.get()) : 0;
+  }
+
+  size_t write(const uint8_t *buf, size_t len) {
+    return f ? std::fwrite(buf, 1, len, f.get()) : 0;
+  }
+
+  bool seek(uint32_t pos) {
+    return f && std::fseek(f.get(), pos, SEEK_SET) == 0;
+  }
+
+  size_t size() {
+    if (!f)
+      return 0;
+    const long pos = std::ftell(f.get());
+    std::fseek(f.get(), 0, SEEK_END);
+    const long end = std::ftell(f.get());
+    std::fseek(f.get(), pos, SEEK_SET);
+    return end;
+  }
+
+  void close() { f.reset(); }
+
+private:
+  std::shared_ptr<std::FILE> f;
+};
+
+class Dir {
+public:
+  Dir() {}
+  explicit Dir(const std::filesystem::path &path) {
+    std::error_code ec;
+    it = std::filesystem::directory_iterator(path, ec);
+  }
+
+  bool next() {
+    if (it == std::filesystem::directory_iterator())
+      return false;
+    name = it->path().filename().string();
+    it.increment(ec);
+    return true;
+  }
+
+  String fileName() const { return name; }
+
+private:
+  std::filesystem::directory_iterator it;
+  std::error_code ec;
+  std::string name;
+};
+
+class FS {
+public:
+  std::filesystem::path root = "flash";
+  size_t size = 1024 * 1024;
+
+  bool begin() { return std::filesystem::is_directory(root); }
+
+  bool format() {
+    std::error_code ec;
+    std::filesystem::remove_all(root, ec);
+    return std::filesystem::create_directories(root, ec);
+  }
+
+  bool info(FSInfo &info) {
+    size_t used = 0;
+    std::error_code ec;
+    for (auto &e : std::filesystem::recursive_directory_iterator(root, ec))
+      used += e.is_regular_file() ? (e.file_size() + 4095) / 4096 * 4096
+                                  : 4096;
+    info = {size, used, 4096, 256, 5, 32};
+    return true;
+  }
+
+  File open(const char *path, const char *mode) {
+    const std::string m = std::string(mode) + "b";
+    return File(std::fopen(host(path).c_str(), m.c_str()));
+  }
+
+  bool exists(const char *path) {
+    return std::filesystem::exists(host(path));
+  }
+
+  bool remove(const char *path) {
+    std::error_code ec;
+    return std::filesystem::remove(host(path), ec);
+  }
+
+  bool mkdir(const char *path) {
+    std::error_code ec;
+    return std::filesystem::create_directory(host(path), ec);
+  }
+
+  Dir openDir(const char *path) { return Dir(host(path)); }
+
+private:
+  std::filesystem::path host(const char *path) {
+    return root / std::filesystem::path(path).relative_path();
+  }
+};
+
+inline FS LittleFS;
+
+#endif // EMULATOR_LITTLEFS_H
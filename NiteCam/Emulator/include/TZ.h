@@ -0,0 +1,15 @@
+/**
+ *  @file    TZ.h
+ *  @brief   Host Stand-In for the ESP8266 Timezone Definitions
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *
+ ***********************************************/
+
+#ifndef EMULATOR_TZ_H
+#define EMULATOR_TZ_H
+
+#define TZ_America_Los_Angeles "PST8PDT,M3.2.0,M11.1.0"
+
+#endif // EMULATOR_TZ_H
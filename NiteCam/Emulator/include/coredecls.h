@@ -0,0 +1,22 @@
+/**
+ *  @file    coredecls.h
+ *  @brief   Host Stand-In for the ESP8266 Core Declarations
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *
+ ***********************************************/
+
+#ifndef EMULATOR_COREDECLS_H
+#define EMULATOR_COREDECLS_H
+
+#include <cstdlib>
+#include <ctime>
+
+// the host clock is already set, so only the timezone is taken
+inline void configTime(const char *tz, const char *) {
+  setenv("TZ", tz, 1);
+  tzset();
+}
+
+#endif // EMULATOR_COREDECLS_H
@@ -0,0 +1,17 @@
+/**
+ *  @file    opt.h
+ *  @brief   Host Stand-In for the lwIP Options
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *
+ ***********************************************/
+
+#ifndef EMULATOR_LWIP_OPT_H
+#define EMULATOR_LWIP_OPT_H
+
+// as the ESP8266 core configures lwIP
+#define TCP_MSS 1460
+#define TCP_SND_BUF (2 * TCP_MSS)
+
+#endif // EMULATOR_LWIP_OPT_H
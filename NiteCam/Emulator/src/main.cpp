@@ -0,0 +1,492 @@
+/**
+ *  @file    main.cpp
+ *  @brief   Nite Cam Host Emulator
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *  @details Builds the firmware against a VC0706 emulated on a pseudo
+ *           terminal, which serves JPEGs from disk at the baud rate in
+ *           effect, with a latency per chunk and replies that fail at a
+ *           given rate, and against a web server whose clients are sinks
+ *           draining at a given WiFi rate. It requests images for every
+ *           chunk size and failure rate, checks what arrives against the
+ *           served JPEGs, and reports latency and throughput.
+ *
+ ***********************************************/
+
+#include "../../src/main.cpp"
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <termios.h>
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <vector>
+
+static const char *usage =
+    "usage: %s [-c chunks] [-f rates] [-n images] [-b baud] [-l ms] "
+    "[-w kB/s] [-m ms] [-x speed] [-s seed] [-d flash-dir] [image-dir]\n"
+    "  -c  chunk sizes to compare (256,512,1024,1456,2048)\n"
+    "  -f  rates at which chunk replies fail, alternately with an error "
+    "status\n"
+    "      and a dropped byte (0,0.01,0.05)\n"
+    "  -n  images to request per chunk size and rate (5)\n"
+    "  -b  baud rate to switch to (115200)\n"
+    "  -l  camera latency per chunk, in ms (1)\n"
+    "  -w  WiFi throughput per client, in kB/s (1000)\n"
+    "  -m  report motion every this many ms, 0 for never (0)\n"
+    "  -x  virtual over real time (10)\n"
+    "  -s  seed of the failures (1)\n"
+    "  -d  keep the flash in this directory, across runs (a temporary one)\n"
+    "  without an image-dir, images of 6kB, 18kB, and 40kB are made up\n";
+
+// the camera, on its end of the pseudo terminal; only the failure rate is
+// changed from the outside, between runs
+static struct {
+  int fd = -1;
+  long baud = CAMERA_BAUD_DEFAULT;
+  std::vector<std::string> images;
+  size_t taken = 0;
+  std::string frame; // held in the frame buffer
+  uint8_t resolution = 0x00;
+  uint8_t downsize = 0x00;
+  uint8_t compression = 0x36;
+  double latency = 1.0; // ms
+  unsigned long motion_ms = 0;
+  std::atomic<double> fail{0.0};
+  unsigned long faults = 0;
+  std::mt19937 rng{1};
+  std::chrono::steady_clock::time_point line; // when the last byte is out
+} vc0706;
+
+// sends at the camera's baud rate, in 10 bits per byte; at another rate than
+// the firmware's, the bytes arrive garbled
+void vc0706_send(std::string bytes) {
+  if (Serial.baud != vc0706.baud)
+    for (char &c : bytes)
+      c = ~c;
+  const auto byte =
+      std::chrono::duration<double>(10.0 / vc0706.baud / emulator_speed);
+  vc0706.line = std::max(vc0706.line, std::chrono::steady_clock::now());
+  for (size_t i = 0; i < bytes.size(); i += 32) {
+    const size_t n = std::min((size_t)32, bytes.size() - i);
+    vc0706.line += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        byte * (double)n);
+    std::this_thread::sleep_until(vc0706.line);
+    if (::write(vc0706.fd, bytes.data() + i, n) < 0)
+      return;
+  }
+}
+
+void vc0706_reply(uint8_t cmd, uint8_t status, const std::string &data = "") {
+  std::string res = {'\x76', '\x00', (char)cmd, (char)status,
+                     (char)data.size()};
+  vc0706_send(res + data);
+}
+
+// the next byte of a command, -1 after ms of silence
+int vc0706_getc(int ms) {
+  struct pollfd pfd = {vc0706.fd, POLLIN, 0};
+  uint8_t c;
+  if (poll(&pfd, 1, ms) <= 0 || ::read(vc0706.fd, &c, 1) != 1)
+    return -1;
+  return c;
+}
+
+// the reply to a read of the frame buffer: a header, the data after the
+// delay the command asks for, in 0.01ms, and a trailer; a failed one has an
+// error status, or a byte less
+void vc0706_read(const uint8_t *args) {
+  const uint32_t addr = (uint32_t)args[2] << 24 | (uint32_t)args[3] << 16 |
+                        (uint32_t)args[4] << 8 | args[5];
+  const uint32_t n = (uint32_t)args[6] << 24 | (uint32_t)args[7] << 16 |
+                     (uint32_t)args[8] << 8 | args[9];
+  const unsigned delay_us = 10 * ((unsigned)args[10] << 8 | args[11]);
+
+  std::string data(n, '\0');
+  if (addr < vc0706.frame.size())
+    vc0706.frame.copy(&data[0], n, addr);
+
+  std::uniform_real_distribution<double> uniform;
+  const bool fault = uniform(vc0706.rng) < vc0706.fail;
+  if (fault && ++vc0706.faults % 2) {
+    vc0706_reply(0x32, 0x03);
+    return;
+  }
+
+  std::string trailer = {'\x76', '\x00', '\x32', '\x00', '\x00'};
+  vc0706_reply(0x32, 0x00);
+  std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(
+      (vc0706.latency + delay_us / 1000.0) / emulator_speed));
+  data += trailer;
+  if (fault)
+    data.erase(std::uniform_int_distribution<size_t>(0, data.size() - 1)(
+                   vc0706.rng),
+               1);
+  vc0706_send(data);
+}
+
+void vc0706_command(uint8_t cmd, const uint8_t *args, uint8_t len) {
+  switch (cmd) {
+  case 0x26: // reset, reboots at the default rate with a banner
+    vc0706_reply(cmd, 0x00);
+    vc0706.baud = CAMERA_BAUD_DEFAULT;
+    vc0706.downsize = 0x00;
+    vc0706_send("VC0703 1.00\r\nCtrl infr exist\r\nUser-defined sensor\r\n"
+                "625\r\nInit end\r\n");
+    return;
+  case 0x11:
+    vc0706_reply(cmd, 0x00, "VC0703 1.00");
+    return;
+  case 0x24: // the new rate takes after the reply
+    for (const struct CameraBaud &b : camera_bauds)
+      if (len == 3 && args[1] == b.code[0] && args[2] == b.code[1]) {
+        vc0706_reply(cmd, 0x00);
+        vc0706.baud = b.baud;
+        return;
+      }
+    break;
+  case 0x30: // reads a register: the image size or the compression
+    if (len == 4 && args[2] == 0x00 && args[3] == 0x19) {
+      vc0706_reply(cmd, 0x00, std::string(1, vc0706.resolution));
+      return;
+    }
+    if (len == 4 && args[2] == 0x12 && args[3] == 0x04) {
+      vc0706_reply(cmd, 0x00, std::string(1, vc0706.compression));
+      return;
+    }
+    break;
+  case 0x31:
+    if (len == 5 && args[2] == 0x00 && args[3] == 0x19)
+      vc0706.resolution = args[4];
+    else if (len == 5 && args[2] == 0x12 && args[3] == 0x04)
+      vc0706.compression = args[4];
+    else
+      break;
+    vc0706_reply(cmd, 0x00);
+    return;
+  case 0x54:
+    if (len != 1)
+      break;
+    vc0706.downsize = args[0];
+    vc0706_reply(cmd, 0x00);
+    return;
+  case 0x55:
+    vc0706_reply(cmd, 0x00, std::string(1, vc0706.downsize));
+    return;
+  case 0x36: // freezes the next image, or resumes or steps
+    if (len == 1 && args[0] == 0x00 && !vc0706.images.empty())
+      vc0706.frame = vc0706.images[vc0706.taken++ % vc0706.images.size()];
+    vc0706_reply(cmd, 0x00);
+    return;
+  case 0x34: {
+    const uint32_t size = vc0706.frame.size();
+    vc0706_reply(cmd, 0x00,
+                 {'\x00', '\x00', (char)(size >> 8), (char)size});
+    return;
+  }
+  case 0x32:
+    if (len != 12)
+      break;
+    vc0706_read(args);
+    return;
+  case 0x37: // motion detection on or off
+  case 0x42:
+    vc0706_reply(cmd, 0x00);
+    return;
+  }
+  vc0706_reply(cmd, 0x01); // not supported
+}
+
+// takes commands and, when idle, reports motion
+void vc0706_run() {
+  auto motion = std::chrono::steady_clock::now();
+  for (;;) {
+    const auto period = std::chrono::duration<double, std::milli>(
+        vc0706.motion_ms / emulator_speed);
+    const int c = vc0706_getc(vc0706.motion_ms ? 1 : 100);
+    if (c < 0) {
+      if (vc0706.motion_ms &&
+          std::chrono::steady_clock::now() - motion >= period) {
+        vc0706_reply(0x39, 0x00);
+        motion = std::chrono::steady_clock::now();
+      }
+      continue;
+    }
+    if (c != 0x56 || vc0706_getc(100) != 0x00)
+      continue;
+    const int cmd = vc0706_getc(100), len = vc0706_getc(100);
+    if (cmd < 0 || len < 0)
+      continue;
+    uint8_t args[256];
+    int i = 0, a = 0;
+    while (i < len && (a = vc0706_getc(100)) >= 0)
+      args[i++] = a;
+    if (i == len)
+      vc0706_command(cmd, args, len);
+  }
+}
+
+bool vc0706_open() {
+  int fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) {
+    std::perror("pty");
+    return false;
+  }
+  vc0706.fd = open(ptsname(fd), O_RDWR | O_NOCTTY);
+  struct termios tio;
+  if (vc0706.fd < 0 || tcgetattr(vc0706.fd, &tio) != 0) {
+    std::perror("pty");
+    return false;
+  }
+  cfmakeraw(&tio);
+  tcsetattr(vc0706.fd, TCSANOW, &tio);
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  Serial.fd = fd;
+  std::thread(vc0706_run).detach();
+  return true;
+}
+
+bool images_load(const char *dir) {
+  std::error_code ec;
+  std::vector<std::filesystem::path> paths;
+  for (auto &e : std::filesystem::directory_iterator(dir, ec)) {
+    const std::string ext = e.path().extension().string();
+    if (ext == ".jpg" || ext == ".jpeg" || ext == ".JPG")
+      paths.push_back(e.path());
+  }
+  std::sort(paths.begin(), paths.end());
+  for (const auto &path : paths) {
+    std::ifstream ifs(path, std::ios::binary);
+    std::ostringstream oss;
+    oss << ifs.rdbuf();
+    if (oss.str().size() > 2 && oss.str().size() < 65536)
+      vc0706.images.push_back(oss.str());
+  }
+  return !vc0706.images.empty();
+}
+
+// the sizes straddle the frame cache, so both ways of sending are taken
+void images_make() {
+  std::mt19937 rng(2);
+  for (size_t size : {6000, 18000, 40000}) {
+    std::string image = "\xFF\xD8";
+    while (image.size() < size - 2)
+      image += (char)rng();
+    vc0706.images.push_back(image + "\xFF\xD9");
+  }
+}
+
+// the image without the time stamp spliced in after SOI
+std::string image_unstamp(std::string body) {
+  if (body.compare(2, 8, std::string("\xFF\xE1\x00\x36" "Exif", 8)) == 0)
+    body.erase(2, 56);
+  if (body.compare(2, 4, std::string("\xFF\xFE\x00\x16", 4)) == 0)
+    body.erase(2, 24);
+  return body;
+}
+
+// runs the firmware until nothing is in transfer or waited for
+bool settle() {
+  const unsigned long start = millis();
+  while (camera.state != CAMERA_IDLE || clients_queued() ||
+         recorder.recipient || frame_fresh(millis())) {
+    if (millis() - start > 60000)
+      return false;
+    loop();
+    yield();
+  }
+  return true;
+}
+
+struct Result {
+  unsigned long ok, failed, bad;
+  unsigned long min_ms = ~0ul, max_ms, sum_ms;
+  unsigned long long bytes;
+};
+
+// requests an image and checks the response: a 200 must hold one of the
+// images served, with the right length, unless it was cut off, as it is when
+// the frame fails after the header went out
+void request(struct Result &r) {
+  WiFiClient c = server.request("/");
+  const unsigned long start = millis();
+  while (c.connected() && millis() - start < 60000) {
+    loop();
+    yield();
+  }
+  if (c.connected()) {
+    c.stop();
+    ++r.bad;
+    return;
+  }
+
+  const std::string &res = c.sink->data;
+  const size_t end = res.find("\r\n\r\n"),
+               length = res.find("Content-Length: ");
+  if (end == std::string::npos || length == std::string::npos) {
+    ++r.bad;
+    return;
+  }
+  const size_t body = res.size() - end - 4,
+               expected = std::strtoul(res.c_str() + length + 16, nullptr, 10);
+  if (res.compare(0, 12, "HTTP/1.1 500") == 0 ||
+      (res.compare(0, 12, "HTTP/1.1 200") == 0 && body < expected)) {
+    ++r.failed;
+    return;
+  }
+  if (res.compare(0, 12, "HTTP/1.1 200") != 0 || body != expected) {
+    ++r.bad;
+    return;
+  }
+  const std::string image = image_unstamp(res.substr(end + 4));
+  if (std::find(vc0706.images.begin(), vc0706.images.end(), image) ==
+      vc0706.images.end()) {
+    ++r.bad;
+    return;
+  }
+  const unsigned long ms = c.sink->closed_ms - c.sink->opened_ms;
+  ++r.ok;
+  r.min_ms = std::min(r.min_ms, ms);
+  r.max_ms = std::max(r.max_ms, ms);
+  r.sum_ms += ms;
+  r.bytes += res.size();
+}
+
+std::vector<double> list(const char *arg) {
+  std::vector<double> values;
+  std::istringstream iss(arg);
+  std::string value;
+  while (std::getline(iss, value, ','))
+    values.push_back(std::atof(value.c_str()));
+  return values;
+}
+
+int main(int argc, char *argv[]) {
+
+  std::vector<double> chunks = list("256,512,1024,1456,2048"),
+                      rates = list("0,0.01,0.05");
+  unsigned long images = 5;
+  long baud = CAMERA_BAUD;
+  const char *flash = nullptr;
+
+  emulator_speed = 10.0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "c:f:n:b:l:w:m:x:s:d:")) != -1) {
+    switch (opt) {
+    case 'c':
+      chunks = list(optarg);
+      break;
+    case 'f':
+      rates = list(optarg);
+      break;
+    case 'n':
+      images = std::strtoul(optarg, nullptr, 10);
+      break;
+    case 'b':
+      baud = std::atol(optarg);
+      break;
+    case 'l':
+      vc0706.latency = std::atof(optarg);
+      break;
+    case 'w':
+      wifi_bytes_per_ms = std::atof(optarg);
+      break;
+    case 'm':
+      vc0706.motion_ms = std::strtoul(optarg, nullptr, 10);
+      break;
+    case 'x':
+      emulator_speed = std::atof(optarg);
+      break;
+    case 's':
+      vc0706.rng.seed(std::strtoul(optarg, nullptr, 10));
+      break;
+    case 'd':
+      flash = optarg;
+      break;
+    default:
+      std::fprintf(stderr, usage, argv[0]);
+      return 1;
+    }
+  }
+
+  if (images == 0 || emulator_speed <= 0.0 || wifi_bytes_per_ms <= 0.0) {
+    std::fprintf(stderr, usage, argv[0]);
+    return 1;
+  }
+
+  if (optind < argc) {
+    if (!images_load(argv[optind])) {
+      std::fprintf(stderr, "no JPEGs in '%s'\n", argv[optind]);
+      return 1;
+    }
+  } else {
+    images_make();
+  }
+
+  char tmp[] = "/tmp/nitecam-XXXXXX";
+  if (!flash && !(flash = mkdtemp(tmp))) {
+    std::perror("mkdtemp");
+    return 1;
+  }
+  LittleFS.root = flash;
+
+  if (!vc0706_open())
+    return 1;
+
+  setup();
+
+  if (baud != camera.baud) {
+    settle();
+    server.request("/transfer?baud=" + std::to_string(baud));
+    if (camera.baud != baud) {
+      std::fprintf(stderr, "unsupported baud rate %ld\n", baud);
+      return 1;
+    }
+  }
+
+  std::printf("baud %ld, WiFi %.0fkB/s, latency %.1fms, x%.0f\n\n",
+              camera.baud, wifi_bytes_per_ms, vc0706.latency,
+              emulator_speed);
+  std::printf("%6s %6s %4s %6s %4s %8s %8s %8s %7s %7s %8s %7s\n", "chunk",
+              "fail", "ok", "failed", "bad", "min(ms)", "mean(ms)",
+              "max(ms)", "kB/s", "retries", "timeouts", "dropped");
+
+  unsigned long bad = 0;
+  for (double chunk : chunks) {
+    settle();
+    server.request("/transfer?chunk=" + std::to_string((long)chunk));
+    for (double rate : rates) {
+      vc0706.fail = rate;
+      struct Result r = {};
+      const unsigned long retries = counters.retries,
+                          timeouts = counters.timeouts;
+      const size_t dropped = Serial.rx_dropped;
+      for (unsigned long i = 0; i < images; i++) {
+        if (!settle()) {
+          ++r.bad;
+          continue;
+        }
+        request(r);
+      }
+      std::printf("%6u %6.3f %4lu %6lu %4lu %8lu %8lu %8lu %7.1f %7lu %8lu "
+                  "%7zu\n",
+                  camera.chunk, rate, r.ok, r.failed, r.bad,
+                  r.ok ? r.min_ms : 0ul, r.ok ? r.sum_ms / r.ok : 0ul,
+                  r.max_ms, r.sum_ms ? (double)r.bytes / r.sum_ms : 0.0,
+                  counters.retries - retries, counters.timeouts - timeouts,
+                  Serial.rx_dropped - dropped);
+      bad += r.bad;
+    }
+  }
+
+  if (flash == tmp)
+    std::filesystem::remove_all(flash);
+
+  return bad ? 2 : 0;
+}
@@ -15,6 +15,31 @@ $dir = './';
 
 $delay = 30;
 
+$motion = false; // record frames around motion instead of every $delay s
+
+$post = 3; // frames after motion, along with the one from before
+
+// splits a multipart stream into its parts
+function frames($fp) {
+
+  $frames = [];
+
+  while (($line = fgets($fp)) !== false) {
+
+    if (stripos($line, 'Content-Length:') === 0) {
+
+      $length = intval(substr($line, 15));
+    } elseif ($line === "\r\n" && isset($length)) {
+
+      $frames[] = stream_get_contents($fp, $length);
+
+      unset($length);
+    }
+  }
+
+  return $frames;
+}
+
 $flag = false;
 
 pcntl_signal(SIGALRM, function ($sig) {
@@ -47,7 +72,22 @@ while (true) {
       $h < 20
     ) { // between 20:00 and 8:00
 
-      if (($fp = @fopen($url, 'r'))) {
+      if ($motion) { // long-polls for up to $delay s
+
+        $fp = @fopen("$url/motion?pre=1&post=$post&timeout=$delay", 'r');
+      } else {
+
+        $fp = @fopen($url, 'r');
+      }
+
+      if ($fp) {
+
+        if ($motion) { // answered at the event
+
+          $now = new DateTime("now", new DateTimeZone('America/Los_Angeles'));
+
+          $now->sub($dt);
+        }
 
         $path = $dir . $now->format('Y-m-d/');
 
@@ -55,9 +95,18 @@ while (true) {
 
         $now->add($dt);
 
-        $path .= $now->format(DATE_W3C) . '.jpeg';
+        $path .= $now->format(DATE_W3C);
+
+        if ($motion) {
+
+          foreach (frames($fp) as $i => $frame)
+            file_put_contents($path . "-$i.jpeg", $frame);
+        } else {
+
+          file_put_contents($path . '.jpeg', $fp);
+        }
 
-        file_put_contents($path, $fp);
+        fclose($fp);
       }
     }
 
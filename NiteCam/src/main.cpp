@@ -11,165 +11,1801 @@
 #include <ESP8266WebServer.h>
 #include <ESP8266WiFi.h>
 #include <ESP8266mDNS.h>
+#include <LittleFS.h>
 
 #include <TZ.h>
 #include <coredecls.h>
+#include <lwip/opt.h>
+#include <time.h>
 
 ESP8266WebServer server(80);
 
+// the camera boots at CAMERA_BAUD_DEFAULT and is switched to CAMERA_BAUD;
+// the VC0706 documents rates up to 115200
+#define CAMERA_BAUD_DEFAULT 115200
+#define CAMERA_BAUD 115200
+
+// the image is read in chunks of a TCP segment, rounded down to a multiple
+// of 8, so every chunk goes out as one full segment; the receive buffer holds
+// a chunk plus its header and trailer while the previous one is sent
+#define CAMERA_CHUNK (TCP_MSS & ~7)
+#define CAMERA_CHUNK_MAX 2048
+#define CAMERA_RETRIES 3
+#define CAMERA_TIMEOUT 1000 // ms, for a command reply
+
+// the camera takes 640x480 pictures, which a request can have downsized, to
+// 320x240 (0x11) or 160x120 (0x22), and compressed by another ratio; the
+// camera is only reconfigured for a frame with other settings than the last
+#define CAMERA_DOWNSIZE 0x00
+#define CAMERA_COMPRESSION 0x80
+
+// capture and transfer are a state machine that camera_step() advances a
+// step at a time, up to CAMERA_STEPS per loop(), so OTA and new requests are
+// served during a transfer
+#define CAMERA_IDLE 0
+#define CAMERA_RESUME 1  // waiting for the replies to resume,
+#define CAMERA_CAPTURE 2 // take a picture,
+#define CAMERA_LENGTH 3  // and read its length
+#define CAMERA_READ 4    // waiting for a chunk
+#define CAMERA_SEND 5    // sending a chunk while the next one arrives
+#define CAMERA_DRAIN 6   // discarding an aborted reply
+#define CAMERA_RELEASE 7 // waiting for the reply to release the frame
+#define CAMERA_CONFIG 8  // waiting for a setting to be taken
+#define CAMERA_STEPS 4
+
+// clients queued for a frame; a client that takes no data for CLIENT_TIMEOUT
+// is dropped as stalled
+#define CLIENT_MAX 4
+#define CLIENT_TIMEOUT 5000 // ms
+#define CLIENT_NONE 0
+#define CLIENT_IMAGE 1
+#define CLIENT_STREAM 2
+#define CLIENT_CLOSING 3 // waiting for its last data to be acknowledged
+#define CLIENT_MOTION 4  // waiting for motion
+#define CLIENT_ARCHIVE 5 // being sent recorded frames
+
+// the last frame is kept in RAM and served again for FRAME_CACHE_AGE ms, 0 to
+// always capture anew, and clients that ask during a capture share it; a
+// frame larger than FRAME_CACHE_SIZE is passed through a chunk at a time, to
+// the clients that asked before its first chunk was read
+#define FRAME_CACHE_AGE 1000 // ms
+#define FRAME_CACHE_SIZE 24576
+
+// once the clock is set, frames are stamped with their time, in an EXIF
+// DateTime and a comment, spliced in after the SOI marker as they are sent
+// and recorded, so the camera's data is not copied; 0 to leave them as taken
+#define FRAME_STAMP 1
+#define FRAME_STAMP_AT 2 // bytes of the SOI marker
+
+// the camera reports motion over the UART, and /motion long-polls for it,
+// optionally answering with frames from around the event: up to
+// MOTION_PRE_MAX from before, which the frame cache holds, and MOTION_POST_MAX
+// after, MOTION_INTERVAL ms apart by default
+#define MOTION_TIMEOUT 30 // s
+#define MOTION_TIMEOUT_MAX 300
+#define MOTION_INTERVAL 1000 // ms
+#define MOTION_PRE_MAX 1
+#define MOTION_POST_MAX 30
+
+// the default and maximum frame rate of /stream
+#define STREAM_FPS 5.0f
+#define STREAM_FPS_MAX 10.0f
+#define STREAM_BOUNDARY "nitecam-frame"
+
+// a frame is recorded to LittleFS every RECORD_INTERVAL ms, 0 for never,
+// RECORD_BLOCK bytes per step; the oldest are removed to keep at most
+// RECORD_SLOTS and RECORD_RESERVE bytes free. The index of the recorded
+// frames, by the slot of their sequence number, survives reboots.
+#define RECORD_INTERVAL 30000 // ms
+#define RECORD_SLOTS 128
+#define RECORD_RESERVE 16384
+#define RECORD_BLOCK 1024
+#define RECORD_DIR "/frames"
+#define RECORD_INDEX "/index"
+#define RECORD_MAGIC 0x3152434E // "NCR1"
+
+struct CameraBaud {
+  long baud;
+  uint8_t code[2];
+};
+
+static const struct CameraBaud camera_bauds[] = {{9600, {0xAE, 0xC8}},
+                                                 {19200, {0x56, 0xE4}},
+                                                 {38400, {0x2A, 0xF2}},
+                                                 {57600, {0x1C, 0x4C}},
+                                                 {115200, {0x0D, 0xA6}}};
+
+static struct {
+  long baud;
+  uint16_t chunk;
+  uint8_t state;
+  uint8_t next; // after draining
+  unsigned long state_ms;
+  unsigned long request_ms;
+  uint16_t n; // bytes in the chunk requested
+  uint8_t retries;
+  uint8_t command; // setting being taken
+  uint8_t turn;    // the client whose settings were used last
+} camera = {CAMERA_BAUD_DEFAULT, CAMERA_CHUNK, CAMERA_IDLE, CAMERA_IDLE, 0ul,
+            0ul, 0, 0, 0, 0};
+
+static_assert(FRAME_CACHE_SIZE >= CAMERA_CHUNK_MAX,
+              "the frame cache doubles as the chunk buffer");
+
+static struct {
+  uint8_t buf[FRAME_CACHE_SIZE];
+  unsigned long seq; // 0 before the first frame
+  unsigned long captured_ms;
+  time_t time;
+  char etag[24];
+  uint8_t stamp[84]; // APP1 and COM segments
+  uint8_t stamp_len;
+  uint8_t downsize;
+  uint8_t compression;
+  uint32_t size;   // 0 until known
+  uint32_t filled; // bytes read from the camera
+  uint32_t base;   // of the chunk in buf, when not buffered
+  bool buffered;   // the whole frame fits in buf
+  bool complete;
+  bool failed;
+} frame;
+
+static struct {
+  unsigned long seq; // of the last event, 0 before the first
+  unsigned long ms;
+  time_t time;
+} motion;
+
+// the camera configuration, read at boot
+static struct {
+  uint8_t reset[4];
+  uint8_t version[4];
+  char firmware[12];
+  uint8_t resolution;
+  uint8_t downsize;
+  uint8_t compression;
+  bool detect;
+} config;
+
+// latencies, in ms, are counted in buckets up to each bound and above the
+// last, as /metrics reports them cumulatively
+#define HISTOGRAM_BUCKETS 8
+
+static const unsigned long histogram_bounds[HISTOGRAM_BUCKETS] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000};
+
+struct Histogram {
+  unsigned long buckets[HISTOGRAM_BUCKETS + 1];
+  unsigned long sum;
+  unsigned long count;
+};
+
+#define METRICS_RATE 10000 // ms over which the client rate is measured
+
+static struct {
+  struct Histogram capture;  // from taking a picture to knowing its size
+  struct Histogram transfer; // from taking a picture to its last byte read
+  struct Histogram response; // from an image request to its last byte sent
+  unsigned long camera_bytes;
+  unsigned long client_bytes;
+  unsigned long rate_bytes; // client bytes at the start of the window
+  unsigned long rate_ms;
+  unsigned long client_rate; // bytes/s over the last window
+} metrics;
+
+void histogram_add(struct Histogram &h, unsigned long ms) {
+  uint8_t i = 0;
+  while (i < HISTOGRAM_BUCKETS && ms > histogram_bounds[i])
+    ++i;
+  ++h.buckets[i];
+  h.sum += ms;
+  ++h.count;
+}
+
+struct RecordHeader {
+  uint32_t magic;
+  uint32_t slots;
+};
+
+struct RecordEntry {
+  uint32_t seq; // 0 for none
+  uint32_t time;
+  uint32_t size;
+};
+
+static struct {
+  struct RecordEntry index[RECORD_SLOTS];
+  uint32_t seq; // of the last frame recorded
+  bool mounted;
+  bool recipient; // of the frame
+  unsigned long frame_seq;
+  unsigned long due;
+  uint32_t offset;          // of the next byte of the frame to write
+  bool stamped;
+  struct RecordEntry entry; // being written
+  File file;
+  unsigned long frames;  // recorded
+  unsigned long skipped; // for lack of room or a failed capture
+  unsigned long errors;  // failed writes
+  unsigned long bytes;   // written
+  unsigned long long write_us;
+} recorder;
+
+uint8_t record_count() {
+  uint8_t count = 0;
+  for (const struct RecordEntry &e : recorder.index)
+    count += e.seq != 0;
+  return count;
+}
+
+// the recorded frames in a time range, sent to a single client as a tar
+// archive, which is made of 512-byte blocks
+static struct {
+  bool active;
+  uint32_t from, to; // unix time
+  uint32_t seq;      // of the frame being sent
+  uint32_t last;     // the newest frame to send
+  uint32_t left;     // bytes of it still to send
+  uint8_t trailer;   // zero blocks that end the archive, still to send
+  File file;
+  uint8_t buf[512];
+  uint16_t sent; // of the block in buf
+} archive;
+
+struct Client {
+  WiFiClient client;
+  uint8_t kind;
+  bool recipient;          // of the frame
+  unsigned long seq;       // of the frame last given
+  unsigned long since;     // the motion event last seen
+  unsigned long interval;  // between stream frames, in ms
+  unsigned long due;       // of the next stream frame, or motion deadline
+  uint8_t frames;          // left to stream, 0 for no limit
+  uint8_t pre;             // frames wanted from before motion
+  uint8_t post;            // and after
+  unsigned long active_ms; // when it last took data
+  unsigned long queued_ms;
+  uint8_t downsize;        // of the frames it wants
+  uint8_t compression;
+  char head[192];          // the response or part header
+  uint8_t head_len;
+  uint8_t head_sent;
+  uint8_t stamp_sent;
+  uint32_t offset; // of the next byte of the frame to send
+};
+
+static struct Client clients[CLIENT_MAX];
+
+static struct {
+  unsigned long stalls;    // clients dropped for not taking data
+  unsigned long retries;   // chunks requested again
+  unsigned long timeouts;  // replies that did not arrive in time
+  unsigned long failures;  // frames abandoned
+  unsigned long rejected;  // requests turned away by a full queue
+  unsigned long cached;    // frames served from the cache
+  unsigned long unchanged; // requests answered with 304
+  unsigned long motions;   // long-polls answered with motion
+} counters;
+
+// capture-to-last-byte latency per baud rate and chunk size
+struct TransferStats {
+  long baud;
+  uint16_t chunk;
+  unsigned long count;
+  unsigned long bytes;
+  unsigned long sum_ms;
+  unsigned long min_ms;
+  unsigned long max_ms;
+  unsigned long retries;
+};
+
+#define TRANSFER_CONFIGS 8
+
+static struct TransferStats transfer_stats[TRANSFER_CONFIGS];
+
+struct TransferStats &transfer_slot() {
+  uint8_t i = 0;
+  for (; i < TRANSFER_CONFIGS - 1 && transfer_stats[i].count; i++)
+    if (transfer_stats[i].baud == camera.baud &&
+        transfer_stats[i].chunk == camera.chunk)
+      return transfer_stats[i];
+  // a new configuration, or the last slot is recycled
+  struct TransferStats &stats = transfer_stats[i];
+  if (stats.baud != camera.baud || stats.chunk != camera.chunk)
+    stats = {camera.baud, camera.chunk, 0ul, 0ul, 0ul, ~0ul, 0ul, 0ul};
+  return stats;
+}
+
+void motion_event() {
+  ++motion.seq;
+  motion.ms = millis();
+  motion.time = time(nullptr);
+}
+
+// whether a 5-byte message is the camera reporting motion, which can come
+// ahead of any reply
+bool motion_reported(const uint8_t *res) {
+  if (res[0] != 0x76 || res[2] != 0x39)
+    return false;
+  motion_event();
+  return true;
+}
+
+// sends a command and reads a reply of len (>= 5) bytes, which is checked for
+// the command and success status
+bool camera_command(const uint8_t *cmd, size_t cmd_len, uint8_t *res,
+                    size_t len) {
+  Serial.write(cmd, cmd_len);
+  do {
+    if (Serial.readBytes(res, 5) != 5)
+      return false;
+  } while (motion_reported(res));
+  return (len == 5 || Serial.readBytes(res + 5, len - 5) == len - 5) &&
+         res[0] == 0x76 && res[2] == cmd[2] && res[3] == 0x00;
+}
+
+// has the camera's motion detection report over the UART
+bool camera_detect() {
+
+  uint8_t res[5];
+
+  uint8_t ctrl[] = {0x56, 0x00, 0x42, 0x03, 0x00, 0x01, 0x01};
+  uint8_t on[] = {0x56, 0x00, 0x37, 0x01, 0x01};
+
+  return camera_command(ctrl, sizeof(ctrl), res, sizeof(res)) &&
+         camera_command(on, sizeof(on), res, sizeof(res));
+}
+
+// the camera replies at the current baud rate and then reboots at its default
+void camera_reset(uint8_t *res, size_t len) {
+
+  uint8_t rst[] = {0x56, 0x00, 0x26, 0x00};
+
+  Serial.write(rst, sizeof(rst));
+  Serial.flush();
+  Serial.updateBaudRate(CAMERA_BAUD_DEFAULT);
+  camera.baud = CAMERA_BAUD_DEFAULT;
+  Serial.readBytes(res, len);
+}
+
+bool camera_baud(long baud) {
+
+  uint8_t res[5];
+
+  for (const struct CameraBaud &b : camera_bauds) {
+    if (b.baud != baud)
+      continue;
+    uint8_t cmd[] = {0x56, 0x00, 0x24, 0x03, 0x01, b.code[0], b.code[1]};
+    if (!camera_command(cmd, sizeof(cmd), res, sizeof(res)))
+      return false;
+    Serial.flush();
+    Serial.updateBaudRate(baud);
+    camera.baud = baud;
+    return true;
+  }
+  return false;
+}
+
+// asks for n bytes of the captured image from addr on; the camera replies
+// with a 5-byte header, the data, and a 5-byte trailer
+void camera_read_request(uint32_t addr, uint16_t n) {
+  uint8_t readphoto[] = {0x56, 0x00, 0x32, 0x0C, 0x00, 0x0A,
+                         (uint8_t)(addr >> 24), (uint8_t)(addr >> 16),
+                         (uint8_t)(addr >> 8), (uint8_t)addr, 0x00, 0x00,
+                         (uint8_t)(n >> 8), (uint8_t)n, 0x00, 0x64};
+  Serial.write(readphoto, sizeof(readphoto));
+}
+
 void VC0706_init() {
 
   uint8_t res[128];
 
-  uint8_t rst[] = {0x56, 0x00, 0x26, 0x00};
   uint8_t ver[] = {0x56, 0x00, 0x11, 0x00};
   uint8_t pxl[] = {0x56, 0x00, 0x31, 0x05, 0x04, 0x01, 0x00, 0x19, 0x00};
-  uint8_t cmp[] = {0x56, 0x00, 0x31, 0x05, 0x01, 0x12, 0x04, 0x80};
+  uint8_t cmp[] = {0x56, 0x00, 0x31, 0x05, 0x01,
+                   0x01, 0x12, 0x04, CAMERA_COMPRESSION};
+  uint8_t get_pxl[] = {0x56, 0x00, 0x30, 0x04, 0x04, 0x01, 0x00, 0x19};
+  uint8_t get_dsz[] = {0x56, 0x00, 0x55, 0x00};
+  uint8_t get_cmp[] = {0x56, 0x00, 0x30, 0x04, 0x01, 0x01, 0x12, 0x04};
 
-  Serial.begin(115200);
+  Serial.setRxBufferSize(CAMERA_CHUNK_MAX + 64);
+  Serial.begin(CAMERA_BAUD_DEFAULT);
 
-  Serial.write(rst, sizeof(rst));
-  Serial.readBytes(res, 128);
+  camera_reset(res, 128);
+  memcpy(config.reset, res, 4);
+
+  camera_baud(CAMERA_BAUD);
 
   Serial.write(ver, sizeof(ver));
   Serial.readBytes(res, 16);
+  memcpy(config.version, res, 4);
+  memcpy(config.firmware, res + 5, 11);
+  config.firmware[11] = '\0';
 
   Serial.write(pxl, sizeof(pxl));
   Serial.readBytes(res, 5);
 
   Serial.write(cmp, sizeof(cmp));
   Serial.readBytes(res, 5);
+
+  // read back what the camera took; a setting that can't be read is set
+  // again for the first frame
+  config.downsize = config.compression = 0xFF;
+  if (camera_command(get_pxl, sizeof(get_pxl), res, 6))
+    config.resolution = res[5];
+  if (camera_command(get_dsz, sizeof(get_dsz), res, 6))
+    config.downsize = res[5];
+  if (camera_command(get_cmp, sizeof(get_cmp), res, 6))
+    config.compression = res[5];
+
+  config.detect = camera_detect();
 }
 
-void VC0706Status() {
+// the commands of /transfer would break into a transfer
+bool camera_busy() {
+  if (camera.state == CAMERA_IDLE)
+    return false;
+  server.sendHeader("Retry-After", "1");
+  server.send(503, "text/plain", "Camera busy");
+  return true;
+}
 
-  uint8_t res[128];
+const char *camera_resolution(uint8_t code) {
+  switch (code) {
+  case 0x00:
+    return "640x480";
+  case 0x11:
+    return "320x240";
+  case 0x22:
+    return "160x120";
+  }
+  return "unknown";
+}
 
-  uint8_t rst[] = {0x56, 0x00, 0x26, 0x00};
-  uint8_t ver[] = {0x56, 0x00, 0x11, 0x00};
-  uint8_t pxl[] = {0x56, 0x00, 0x31, 0x05, 0x04, 0x01, 0x00, 0x19, 0x00};
-  // uint8_t cmp[] = { 0x56, 0x00, 0x31, 0x05, 0x01, 0x12, 0x04, 0x80 };
-  uint8_t mtn[] = {0x56, 0x00, 0x38, 0x00};
+// served from what was read at boot, so it never disturbs a transfer
+void VC0706Status() {
 
-  Serial.begin(115200);
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+           "reset: 0x%X 0x%X 0x%X 0x%X\nversion: 0x%X 0x%X 0x%X 0x%X (%s)\n"
+           "size: 0x%X (%s)\ndownsize: 0x%X (%s)\ncompression: 0x%X\n"
+           "motion: %s\nbaud: %ld\nchunk: %u\n",
+           config.reset[0], config.reset[1], config.reset[2], config.reset[3],
+           config.version[0], config.version[1], config.version[2],
+           config.version[3], config.firmware, config.resolution,
+           camera_resolution(config.resolution), config.downsize,
+           camera_resolution(config.downsize), config.compression,
+           config.detect ? "on" : "off", camera.baud, camera.chunk);
 
-  Serial.write(rst, sizeof(rst));
-  Serial.readBytes(res, 128);
+  server.send(200, "text/plain", buf);
+}
 
-  uint8_t r1[4];
-  memcpy(r1, res, 4);
+// clients waiting for or being sent a response
+uint8_t clients_queued() {
+  uint8_t count = 0;
+  for (const struct Client &c : clients)
+    count += c.kind == CLIENT_IMAGE || c.kind == CLIENT_STREAM ||
+             c.kind == CLIENT_MOTION || c.kind == CLIENT_ARCHIVE;
+  return count;
+}
 
-  Serial.write(ver, sizeof(ver));
-  Serial.readBytes(res, 16);
+// selects the baud rate and chunk size with the 'baud' and 'chunk' arguments
+// and reports the transfer latency for every configuration used
+void TransferConfig() {
 
-  uint8_t r2[4];
-  memcpy(r2, res, 4);
+  if ((server.hasArg("baud") || server.hasArg("chunk")) && camera_busy())
+    return;
 
-  char vers[12];
-  memcpy(vers, res + 5, 11);
-  vers[11] = '\0';
+  if (server.hasArg("baud") && !camera_baud(server.arg("baud").toInt())) {
+    server.send(400, "text/plain", "Unsupported baud rate");
+    return;
+  }
 
-  Serial.write(pxl, sizeof(pxl));
-  Serial.readBytes(res, 5);
+  if (server.hasArg("chunk")) {
+    long chunk = server.arg("chunk").toInt() & ~7l;
+    if (chunk < 8 || chunk > CAMERA_CHUNK_MAX) {
+      server.send(400, "text/plain", "Unsupported chunk size");
+      return;
+    }
+    camera.chunk = chunk;
+  }
 
-  uint8_t r3[4];
-  memcpy(r3, res, 4);
+  char buf[96 * (TRANSFER_CONFIGS + 4)];
+  int len = snprintf(buf, sizeof(buf), "baud %ld, chunk %u\n\n", camera.baud,
+                     camera.chunk);
+  len += snprintf(buf + len, sizeof(buf) - len,
+                  "clients %u, stalls %lu, retries %lu, timeouts %lu, "
+                  "failures %lu, rejected %lu, cached %lu, unchanged %lu, "
+                  "motion events %lu, motions %lu\n\n",
+                  clients_queued(), counters.stalls, counters.retries,
+                  counters.timeouts, counters.failures, counters.rejected,
+                  counters.cached, counters.unchanged, motion.seq,
+                  counters.motions);
+  len += snprintf(buf + len, sizeof(buf) - len,
+                  "%7s %6s %6s %8s %8s %8s %8s %7s\n", "baud", "chunk",
+                  "count", "min(ms)", "mean(ms)", "max(ms)", "kB/s",
+                  "retries");
+  for (const struct TransferStats &stats : transfer_stats) {
+    if (!stats.count)
+      continue;
+    len += snprintf(buf + len, sizeof(buf) - len,
+                    "%7ld %6u %6lu %8lu %8lu %8lu %8lu %7lu\n", stats.baud,
+                    stats.chunk, stats.count, stats.min_ms,
+                    stats.sum_ms / stats.count, stats.max_ms,
+                    stats.sum_ms ? stats.bytes / stats.sum_ms : 0ul,
+                    stats.retries);
+  }
 
-  Serial.write(pxl, sizeof(pxl));
-  Serial.readBytes(res, 5);
+  server.send(200, "text/plain", buf);
+}
 
-  uint8_t r4[4];
-  memcpy(r4, res, 4);
+int metrics_histogram(char *buf, size_t size, const char *name,
+                      const char *help, const struct Histogram &h) {
+  int len = snprintf(buf, size,
+                     "# HELP nitecam_%s_ms %s\n"
+                     "# TYPE nitecam_%s_ms histogram\n",
+                     name, help, name);
+  unsigned long count = 0;
+  for (uint8_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    count += h.buckets[i];
+    len += snprintf(buf + len, size - len,
+                    "nitecam_%s_ms_bucket{le=\"%lu\"} %lu\n", name,
+                    histogram_bounds[i], count);
+  }
+  len += snprintf(buf + len, size - len,
+                  "nitecam_%s_ms_bucket{le=\"+Inf\"} %lu\n"
+                  "nitecam_%s_ms_sum %lu\nnitecam_%s_ms_count %lu\n",
+                  name, h.count, name, h.sum, name, h.count);
+  return len;
+}
 
-  Serial.write(mtn, sizeof(mtn));
-  Serial.readBytes(res, 6);
+void metrics_rate(unsigned long ms) {
+  if (ms - metrics.rate_ms < METRICS_RATE)
+    return;
+  metrics.client_rate =
+      (metrics.client_bytes - metrics.rate_bytes) * 1000ull /
+      (ms - metrics.rate_ms);
+  metrics.rate_bytes = metrics.client_bytes;
+  metrics.rate_ms = ms;
+}
 
-  uint8_t r5 = res[5];
+// Reports latencies, throughput, counters, and the heap in the Prometheus
+// text format, without touching the camera. Sent in parts, to keep the
+// buffer off the heap and the stack small.
+void Metrics() {
+
+  char buf[768];
+  int len;
+
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/plain; version=0.0.4", "");
+
+  len = metrics_histogram(buf, sizeof(buf), "capture",
+                          "Time from taking a picture to knowing its size.",
+                          metrics.capture);
+  server.sendContent(buf, len);
+
+  len = metrics_histogram(buf, sizeof(buf), "transfer",
+                          "Time from taking a picture to its last byte read.",
+                          metrics.transfer);
+  server.sendContent(buf, len);
+
+  len = metrics_histogram(buf, sizeof(buf), "response",
+                          "Time from an image request to its last byte sent.",
+                          metrics.response);
+  server.sendContent(buf, len);
+
+  const unsigned long transfer_ms = metrics.transfer.sum;
+
+  len = snprintf(
+      buf, sizeof(buf),
+      "# TYPE nitecam_camera_bytes_total counter\n"
+      "nitecam_camera_bytes_total %lu\n"
+      "# TYPE nitecam_camera_bytes_per_second gauge\n"
+      "nitecam_camera_bytes_per_second %lu\n"
+      "# TYPE nitecam_client_bytes_total counter\n"
+      "nitecam_client_bytes_total %lu\n"
+      "# TYPE nitecam_client_bytes_per_second gauge\n"
+      "nitecam_client_bytes_per_second %lu\n"
+      "# TYPE nitecam_clients gauge\nnitecam_clients %u\n",
+      metrics.camera_bytes,
+      transfer_ms ? (unsigned long)(metrics.camera_bytes * 1000ull /
+                                    transfer_ms)
+                  : 0ul,
+      metrics.client_bytes, metrics.client_rate, clients_queued());
+  server.sendContent(buf, len);
+
+  len = snprintf(
+      buf, sizeof(buf),
+      "# TYPE nitecam_events_total counter\n"
+      "nitecam_events_total{event=\"stall\"} %lu\n"
+      "nitecam_events_total{event=\"retry\"} %lu\n"
+      "nitecam_events_total{event=\"timeout\"} %lu\n"
+      "nitecam_events_total{event=\"failure\"} %lu\n"
+      "nitecam_events_total{event=\"rejected\"} %lu\n"
+      "nitecam_events_total{event=\"cached\"} %lu\n"
+      "nitecam_events_total{event=\"unchanged\"} %lu\n"
+      "nitecam_events_total{event=\"motion\"} %lu\n",
+      counters.stalls, counters.retries, counters.timeouts, counters.failures,
+      counters.rejected, counters.cached, counters.unchanged, motion.seq);
+  server.sendContent(buf, len);
+
+  FSInfo info = {};
+  if (recorder.mounted)
+    LittleFS.info(info);
+  len = snprintf(
+      buf, sizeof(buf),
+      "# TYPE nitecam_flash_written_bytes_total counter\n"
+      "nitecam_flash_written_bytes_total %lu\n"
+      "# TYPE nitecam_flash_write_ms_total counter\n"
+      "nitecam_flash_write_ms_total %lu\n"
+      "# TYPE nitecam_flash_write_bytes_per_second gauge\n"
+      "nitecam_flash_write_bytes_per_second %lu\n"
+      "# TYPE nitecam_flash_used_bytes gauge\nnitecam_flash_used_bytes %lu\n"
+      "# TYPE nitecam_flash_size_bytes gauge\nnitecam_flash_size_bytes %lu\n"
+      "# TYPE nitecam_recorded_frames gauge\nnitecam_recorded_frames %u\n"
+      "# TYPE nitecam_record_events_total counter\n"
+      "nitecam_record_events_total{event=\"recorded\"} %lu\n"
+      "nitecam_record_events_total{event=\"skipped\"} %lu\n"
+      "nitecam_record_events_total{event=\"error\"} %lu\n",
+      recorder.bytes, (unsigned long)(recorder.write_us / 1000),
+      recorder.write_us
+          ? (unsigned long)(recorder.bytes * 1000000ull / recorder.write_us)
+          : 0ul,
+      (unsigned long)info.usedBytes, (unsigned long)info.totalBytes,
+      record_count(), recorder.frames, recorder.skipped, recorder.errors);
+  server.sendContent(buf, len);
+
+  len = snprintf(buf, sizeof(buf),
+                 "# TYPE nitecam_heap_free_bytes gauge\n"
+                 "nitecam_heap_free_bytes %u\n"
+                 "# TYPE nitecam_heap_max_block_bytes gauge\n"
+                 "nitecam_heap_max_block_bytes %u\n"
+                 "# TYPE nitecam_heap_fragmentation_percent gauge\n"
+                 "nitecam_heap_fragmentation_percent %u\n"
+                 "# TYPE nitecam_uptime_seconds counter\n"
+                 "nitecam_uptime_seconds %lu\n",
+                 (unsigned)ESP.getFreeHeap(),
+                 (unsigned)ESP.getMaxFreeBlockSize(),
+                 (unsigned)ESP.getHeapFragmentation(), millis() / 1000);
+  server.sendContent(buf, len);
+}
 
-  char buf[192];
-  snprintf(
-      buf, 192,
-      "reset: 0x%X 0x%X 0x%X 0x%X\nversion: 0x%X 0x%X 0x%X 0x%X (%s)\nsize: "
-      "0x%X 0x%X 0x%X 0x%X\ncompression: 0x%X 0x%X 0x%X 0x%X\nmotion: 0x%X\n",
-      r1[0], r1[1], r1[2], r1[3], r2[0], r2[1], r2[2], r2[3], vers, r3[0],
-      r3[1], r3[2], r3[3], r4[0], r4[1], r4[2], r4[3], r5);
+void camera_enter(uint8_t state) {
+  camera.state = state;
+  camera.state_ms = millis();
+}
 
-  server.send(200, "text/plain", buf);
+// polls for the reply to a command, of len (>= 5) bytes: 0 while pending, 1
+// on success, and -1 on an error status or a timeout; the rest of a reply
+// follows its first 5 bytes at once
+int8_t camera_poll(uint8_t *res, size_t len, uint8_t cmd) {
+  if (Serial.available() < 5) {
+    if (millis() - camera.state_ms < CAMERA_TIMEOUT)
+      return 0;
+    ++counters.timeouts;
+    return -1;
+  }
+  Serial.readBytes(res, 5);
+  if (motion_reported(res))
+    return 0;
+  if (len > 5 && Serial.readBytes(res + 5, len - 5) != len - 5)
+    return -1;
+  return res[0] == 0x76 && res[2] == cmd && res[3] == 0x00 ? 1 : -1;
 }
 
-void JPEGPicture() {
+// requests the n bytes following those read so far
+void camera_request(uint16_t n) {
+  camera_read_request(frame.filled, n);
+  camera.request_ms = millis();
+}
 
-  uint8_t res[128];
+// sends the command for the first setting of the frame that the camera
+// doesn't have; false when it has them all
+bool camera_configure() {
+  if (config.downsize != frame.downsize) {
+    uint8_t dsz[] = {0x56, 0x00, 0x54, 0x01, frame.downsize};
+    Serial.write(dsz, sizeof(dsz));
+    camera.command = 0x54;
+  } else if (config.compression != frame.compression) {
+    uint8_t cmp[] = {0x56, 0x00, 0x31, 0x05, 0x01,
+                     0x01, 0x12, 0x04, frame.compression};
+    Serial.write(cmp, sizeof(cmp));
+    camera.command = 0x31;
+  } else {
+    return false;
+  }
+  camera_enter(CAMERA_CONFIG);
+  return true;
+}
 
-  uint8_t takephoto[] = {0x56, 0x00, 0x36, 0x01, 0x00};
-  uint8_t bufflen[] = {0x56, 0x00, 0x34, 0x01, 0x00};
-  uint8_t readphoto[] = {0x56, 0x00, 0x32, 0x0C, 0x00, 0x0A, 0x00, 0x00,
-                         0x00, 0x00, 0x00, 0x0,  0x10, 0x00, 0x00, 0x64};
+// moves on from the last frame, to take the next
+void camera_resume() {
   uint8_t rsm[] = {0x56, 0x00, 0x36, 0x01, 0x02};
+  Serial.write(rsm, sizeof(rsm));
+  camera_enter(CAMERA_RESUME);
+}
 
+// steps past the frozen frame
+void camera_release() {
+  uint8_t rsm[] = {0x56, 0x00, 0x36, 0x01, 0x03};
   Serial.write(rsm, sizeof(rsm));
-  Serial.readBytes(res, 5);
+  camera_enter(CAMERA_RELEASE);
+}
 
-  if (res[3] != 0x0) {
-    server.send(500, "text/plain", "Failed to move to next frame");
+// Stamps the frame with its time, as an APP1 segment holding an EXIF IFD0
+// with only the local DateTime, and a COM segment with the UTC time in ISO
+// 8601. Tools that read either need no decoding of the image.
+void frame_stamp() {
+
+  // the segment length, a TIFF header, and one ASCII entry of 20 bytes at
+  // offset 26 from that header, after the entry count and next IFD offset
+  static const uint8_t exif[] = {
+      0xFF, 0xE1, 0x00, 0x36, 'E',  'x',  'i',  'f',  0x00, 0x00, 'I',  'I',
+      0x2A, 0x00, 0x08, 0x00, 0x00, 0x00, 0x01, 0x00, 0x32, 0x01, 0x02, 0x00,
+      0x14, 0x00, 0x00, 0x00, 0x1A, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+  static const uint8_t com[] = {0xFF, 0xFE, 0x00, 0x16};
+
+  frame.stamp_len = 0;
+  if (!FRAME_STAMP || frame.time <= 1600000000l) // the clock is not set
     return;
-  }
 
-  Serial.write(takephoto, sizeof(takephoto));
-  Serial.readBytes(res, 5);
+  uint8_t *p = frame.stamp;
+  memcpy(p, exif, sizeof(exif));
+  p += sizeof(exif);
+  p += strftime((char *)p, 20, "%Y:%m:%d %H:%M:%S", localtime(&frame.time));
+  *p++ = '\0';
+  memcpy(p, com, sizeof(com));
+  p += sizeof(com);
+  p += strftime((char *)p, 21, "%Y-%m-%dT%H:%M:%SZ", gmtime(&frame.time));
+  frame.stamp_len = p - frame.stamp;
+}
+
+// a completed frame in the cache that is younger than FRAME_CACHE_AGE
+bool frame_fresh(unsigned long ms) {
+  return frame.complete && frame.buffered &&
+         ms - frame.captured_ms < FRAME_CACHE_AGE;
+}
+
+// whether the frame is taken with the settings
+bool frame_matches(uint8_t downsize, uint8_t compression) {
+  return frame.downsize == downsize && frame.compression == compression;
+}
 
-  if (res[3] != 0x0) {
-    server.send(500, "text/plain", "Failed to take picture");
+// a frame in capture that can still be sent from its first byte
+bool frame_joinable() {
+  return camera.state != CAMERA_IDLE && !frame.complete && !frame.failed &&
+         (frame.buffered || frame.base == 0);
+}
+
+void record_path(char *path, size_t size, uint32_t seq) {
+  snprintf(path, size, RECORD_DIR "/%08lx.jpg", (unsigned long)seq);
+}
+
+// stores the index entry of slot i
+bool record_save(uint8_t i) {
+  File f = LittleFS.open(RECORD_INDEX, "r+");
+  if (!f)
+    return false;
+  const bool ok = f.seek(sizeof(struct RecordHeader) +
+                         i * sizeof(struct RecordEntry)) &&
+                  f.write((const uint8_t *)&recorder.index[i],
+                          sizeof(struct RecordEntry)) ==
+                      sizeof(struct RecordEntry);
+  f.close();
+  return ok;
+}
+
+// Mounts the file system and loads the index, starting afresh when it is
+// missing or from another layout. Entries whose file is missing or of the
+// wrong size, e.g., after a reset during a write, are dropped, as are files
+// not in the index.
+void record_init() {
+
+  if (!LittleFS.begin() && !(LittleFS.format() && LittleFS.begin()))
     return;
+  recorder.mounted = true;
+
+  const struct RecordHeader header = {RECORD_MAGIC, RECORD_SLOTS};
+  struct RecordHeader stored = {0, 0};
+  File f = LittleFS.open(RECORD_INDEX, "r");
+  if (f) {
+    if (f.read((uint8_t *)&stored, sizeof(stored)) != sizeof(stored) ||
+        stored.magic != header.magic || stored.slots != header.slots ||
+        f.read((uint8_t *)recorder.index, sizeof(recorder.index)) !=
+            sizeof(recorder.index))
+      stored.magic = 0;
+    f.close();
+  }
+  if (stored.magic != header.magic) {
+    memset(recorder.index, 0, sizeof(recorder.index));
+    f = LittleFS.open(RECORD_INDEX, "w");
+    f.write((const uint8_t *)&header, sizeof(header));
+    f.write((const uint8_t *)recorder.index, sizeof(recorder.index));
+    f.close();
   }
 
-  Serial.write(bufflen, sizeof(bufflen));
+  char path[32];
+  for (uint8_t i = 0; i < RECORD_SLOTS; i++) {
+    struct RecordEntry &e = recorder.index[i];
+    if (!e.seq)
+      continue;
+    record_path(path, sizeof(path), e.seq);
+    f = LittleFS.open(path, "r");
+    const bool ok = f && f.size() == e.size;
+    if (f)
+      f.close();
+    if (!ok) {
+      e = {0, 0, 0};
+      record_save(i);
+      continue;
+    }
+    recorder.seq = _max(recorder.seq, e.seq);
+  }
+
+  LittleFS.mkdir(RECORD_DIR);
+  Dir dir = LittleFS.openDir(RECORD_DIR);
+  while (dir.next()) {
+    const uint32_t seq = strtoul(dir.fileName().c_str(), nullptr, 16);
+    if (!seq || recorder.index[seq % RECORD_SLOTS].seq != seq) {
+      snprintf(path, sizeof(path), RECORD_DIR "/%s", dir.fileName().c_str());
+      LittleFS.remove(path);
+    }
+  }
+
+  recorder.due = millis();
+}
+
+// whether a download still has to send the recorded frame
+bool archive_needs(const struct RecordEntry &e) {
+  return archive.active && e.seq >= archive.seq && e.seq <= archive.last &&
+         e.time >= archive.from && e.time <= archive.to;
+}
+
+void archive_end() {
+  archive.active = false;
+  if (archive.file)
+    archive.file.close();
+}
 
-  Serial.readBytes(res, 9);
+// Removes the oldest frames until the slot of seq is free and size bytes
+// fit with RECORD_RESERVE to spare. Frames an archive download still has to
+// send are kept, and then there is no room.
+bool record_evict(uint32_t seq, uint32_t size) {
+  char path[32];
+  FSInfo info;
+  for (uint32_t s = seq > RECORD_SLOTS ? seq - RECORD_SLOTS : 1; s < seq;
+       s++) {
+    struct RecordEntry &e = recorder.index[s % RECORD_SLOTS];
+    if (e.seq != s)
+      continue;
+    if (!LittleFS.info(info))
+      return false;
+    if (recorder.index[seq % RECORD_SLOTS].seq == 0 &&
+        info.usedBytes + size + RECORD_RESERVE <= info.totalBytes)
+      return true;
+    if (archive_needs(e))
+      return false;
+    record_path(path, sizeof(path), s);
+    LittleFS.remove(path);
+    e = {0, 0, 0};
+    record_save(s % RECORD_SLOTS);
+  }
+  return LittleFS.info(info) &&
+         recorder.index[seq % RECORD_SLOTS].seq == 0 &&
+         info.usedBytes + size + RECORD_RESERVE <= info.totalBytes;
+}
 
-  int32_t bytes = res[5];
-  bytes <<= 8;
-  bytes |= res[6];
-  bytes <<= 8;
-  bytes |= res[7];
-  bytes <<= 8;
-  bytes |= res[8];
+bool recorder_wants(unsigned long ms) {
+  return RECORD_INTERVAL && recorder.mounted && !recorder.recipient &&
+         (long)(ms - recorder.due) >= 0;
+}
 
-  if (res[3] != 0x0) {
-    server.send(500, "text/plain", "Picture is -zero- bytes in size");
+// the frame size is known: makes room and opens its file
+void recorder_begin() {
+  const uint32_t seq = recorder.seq + 1;
+  char path[32];
+  record_path(path, sizeof(path), seq);
+  if (record_evict(seq, frame.size + frame.stamp_len) &&
+      (recorder.file = LittleFS.open(path, "w"))) {
+    recorder.entry = {seq, (uint32_t)frame.time,
+                      frame.size + frame.stamp_len};
     return;
   }
+  ++recorder.skipped;
+  recorder.recipient = false;
+}
 
-  server.sendHeader("Refresh", "30");
-  server.setContentLength(bytes);
-  server.send(200, "image/jpeg", "");
+void recorder_attach(unsigned long ms) {
+  recorder.due += RECORD_INTERVAL;
+  if ((long)(ms - recorder.due) >= 0) // fell behind
+    recorder.due = ms + RECORD_INTERVAL;
+  recorder.recipient = true;
+  recorder.frame_seq = frame.seq;
+  recorder.offset = 0;
+  recorder.stamped = false;
+  if (frame.size)
+    recorder_begin();
+}
 
-  WiFiClient client = server.client();
+// drops a partly written frame
+void recorder_fail() {
+  if (!recorder.recipient)
+    return;
+  recorder.recipient = false;
+  if (!recorder.file)
+    return;
+  recorder.file.close();
+  char path[32];
+  record_path(path, sizeof(path), recorder.entry.seq);
+  LittleFS.remove(path);
+}
 
-  Serial.setTimeout(200);
+// writes up to RECORD_BLOCK bytes of what was read of the frame, or its
+// stamp, and adds the frame to the index once all is written; returns
+// whether it wrote
+bool recorder_write() {
+  if (!recorder.recipient || !recorder.file)
+    return false;
+  const bool stamp = recorder.offset == FRAME_STAMP_AT && !recorder.stamped;
+  const uint8_t *data = frame.stamp;
+  size_t n = frame.stamp_len;
+  if (stamp) {
+    recorder.stamped = true;
+  } else {
+    if (recorder.offset == frame.filled)
+      return false;
+    const uint32_t end = recorder.offset < FRAME_STAMP_AT
+                             ? _min(frame.filled, (uint32_t)FRAME_STAMP_AT)
+                             : frame.filled;
+    data = frame.buf + (recorder.offset - frame.base);
+    n = _min((uint32_t)RECORD_BLOCK, end - recorder.offset);
+  }
+  const unsigned long us = micros();
+  const size_t w = n ? recorder.file.write(data, n) : 0;
+  if (!stamp && w == n && recorder.offset + w == frame.size)
+    recorder.file.close(); // flushes
+  recorder.write_us += micros() - us;
+  recorder.bytes += w;
+  if (w != n) {
+    ++recorder.errors;
+    recorder_fail();
+    return true;
+  }
+  if (!stamp)
+    recorder.offset += w;
+  if (recorder.offset < frame.size)
+    return true;
+  recorder.recipient = false;
+  const uint8_t i = recorder.entry.seq % RECORD_SLOTS;
+  recorder.index[i] = recorder.entry;
+  if (!record_save(i))
+    ++recorder.errors;
+  recorder.seq = recorder.entry.seq;
+  ++recorder.frames;
+  return true;
+}
 
-  uint16_t addr = 0, n;
-  uint8_t buf[517];
-  while (bytes > 0) {
-    n = _min(512, bytes);
-    readphoto[8] = addr >> 8;
-    readphoto[9] = addr & 0xFF;
-    readphoto[12] = n >> 8;
-    readphoto[13] = n & 0xFF;
-    Serial.write(readphoto, sizeof(readphoto));
-    if (Serial.readBytes(buf, n + 5) != (n + 5U))
+void client_drop(struct Client &c) {
+  if (c.kind == CLIENT_ARCHIVE)
+    archive_end();
+  c.client.stop();
+  c.client = WiFiClient();
+  c.kind = CLIENT_NONE;
+  c.recipient = false;
+}
+
+// lets the last data of a response go out before the connection is closed,
+// as stopping right away blocks until it is acknowledged
+void client_close(struct Client &c) {
+  c.kind = CLIENT_CLOSING;
+  c.recipient = false;
+  c.active_ms = millis();
+}
+
+// the next recorded frame after seq in the time range of the archive, 0 for
+// none
+uint32_t archive_next(uint32_t seq) {
+  while (++seq <= archive.last) {
+    const struct RecordEntry &e = recorder.index[seq % RECORD_SLOTS];
+    if (e.seq == seq && e.time >= archive.from && e.time <= archive.to)
+      return seq;
+  }
+  return 0;
+}
+
+// a ustar header for the recorded frame, named after the time it was taken
+void archive_header(const struct RecordEntry &e) {
+
+  char *h = (char *)archive.buf;
+  const time_t t = e.time;
+
+  int len = 0;
+  if (t > 1600000000l) // the clock was set
+    len = strftime(h, 100, "%Y%m%dT%H%M%SZ-", gmtime(&t));
+  snprintf(h + len, 100 - len, "%08lu.jpg", (unsigned long)e.seq);
+  snprintf(h + 100, 8, "%07o", 0644);             // mode
+  snprintf(h + 108, 8, "%07o", 0);                // uid
+  snprintf(h + 116, 8, "%07o", 0);                // gid
+  snprintf(h + 124, 12, "%011lo", (unsigned long)e.size);
+  snprintf(h + 136, 12, "%011lo", (unsigned long)e.time);
+  memset(h + 148, ' ', 8); // the checksum counts itself as spaces
+  h[156] = '0';            // a regular file
+  memcpy(h + 257, "ustar\0" "00", 8);
+
+  unsigned long sum = 0;
+  for (const uint8_t b : archive.buf)
+    sum += b;
+  snprintf(h + 148, 8, "%06lo", sum);
+  h[155] = ' ';
+}
+
+// the next block of the archive: a header, frame data padded with zeros, or
+// one of the zero blocks at the end; false once all is sent. A frame that
+// can't be read is sent as zeros, to keep to the announced length.
+bool archive_fill() {
+
+  memset(archive.buf, 0, sizeof(archive.buf));
+  archive.sent = 0;
+
+  if (archive.left) {
+    const size_t n = _min(archive.left, (uint32_t)sizeof(archive.buf));
+    if (archive.file && archive.file.read(archive.buf, n) != n)
+      archive.file.close();
+    archive.left -= n;
+    if (!archive.left && archive.file)
+      archive.file.close();
+    return true;
+  }
+
+  const uint32_t seq = archive_next(archive.seq);
+  if (seq) {
+    const struct RecordEntry &e = recorder.index[seq % RECORD_SLOTS];
+    char path[32];
+    record_path(path, sizeof(path), seq);
+    archive.seq = seq;
+    archive.left = e.size;
+    archive.file = LittleFS.open(path, "r");
+    archive_header(e);
+    return true;
+  }
+
+  if (!archive.trailer)
+    return false;
+  --archive.trailer;
+  return true;
+}
+
+// writes the archive as far as the client's TCP send buffer takes it, never
+// blocking; returns whether anything was written
+bool archive_send(struct Client &c, unsigned long ms) {
+  size_t room = c.client.availableForWrite();
+  if (!room) {
+    if (ms - c.active_ms > CLIENT_TIMEOUT) {
+      ++counters.stalls;
+      client_drop(c);
+    }
+    return false;
+  }
+  bool sent = false;
+  while (room) {
+    if (archive.sent == sizeof(archive.buf) && !archive_fill()) {
+      archive_end();
+      client_close(c);
+      return sent;
+    }
+    const size_t w =
+        c.client.write(archive.buf + archive.sent,
+                       _min(room, sizeof(archive.buf) - archive.sent));
+    if (!w)
+      break;
+    archive.sent += w;
+    room -= w;
+    metrics.client_bytes += w;
+    c.active_ms = ms;
+    sent = true;
+  }
+  return sent;
+}
+
+// whether a client waiting for motion wants a frame from before it kept
+bool client_preroll(const struct Client &c, unsigned long ms) {
+  return c.kind == CLIENT_MOTION && c.pre &&
+         !(frame.complete && frame.buffered &&
+           frame_matches(c.downsize, c.compression) &&
+           ms - frame.captured_ms < c.interval);
+}
+
+bool client_wants(const struct Client &c, unsigned long ms) {
+  return !c.recipient &&
+         (c.kind == CLIENT_IMAGE ||
+          (c.kind == CLIENT_STREAM && (long)(ms - c.due) >= 0));
+}
+
+// the response header of an image, or the part header of a stream, which
+// starts with the CRLF that ends the previous part; before the first part
+// that is an empty preamble
+uint8_t client_head(struct Client &c) {
+
+  if (c.kind == CLIENT_STREAM)
+    return snprintf(c.head, sizeof(c.head),
+                    "\r\n--" STREAM_BOUNDARY "\r\nContent-Type: image/jpeg\r\n"
+                    "Content-Length: %u\r\n\r\n",
+                    (unsigned)(frame.size + frame.stamp_len));
+
+  char modified[64] = "";
+  if (frame.time > 1600000000l) // the clock is set
+    strftime(modified, sizeof(modified),
+             "Last-Modified: %a, %d %b %Y %H:%M:%S GMT\r\n",
+             gmtime(&frame.time));
+
+  return snprintf(c.head, sizeof(c.head),
+                  "HTTP/1.1 200 OK\r\nContent-Type: image/jpeg\r\n"
+                  "Content-Length: %u\r\nETag: %s\r\n%sRefresh: 30\r\n"
+                  "Connection: close\r\n\r\n",
+                  (unsigned)(frame.size + frame.stamp_len), frame.etag,
+                  modified);
+}
+
+void clients_poll(unsigned long ms) {
+  for (struct Client &c : clients) {
+    if (c.kind == CLIENT_NONE)
       continue;
-    client.write(buf + 5, n);
-    addr += n;
-    bytes -= n;
+    if (!c.client.connected() ||
+        (c.kind == CLIENT_CLOSING &&
+         (c.client.availableForWrite() >= TCP_SND_BUF ||
+          ms - c.active_ms > CLIENT_TIMEOUT)))
+      client_drop(c);
   }
-  Serial.readBytes(buf, 517);
+}
 
-  Serial.setTimeout(1000);
+// makes the client a recipient of the frame
+void client_attach(struct Client &c, unsigned long ms) {
+  if (c.kind == CLIENT_STREAM) {
+    c.due += c.interval;
+    if ((long)(ms - c.due) >= 0) // fell behind, don't burst
+      c.due = ms + c.interval;
+  }
+  c.recipient = true;
+  c.seq = frame.seq;
+  c.offset = 0;
+  c.head_sent = c.stamp_sent = 0;
+  c.head_len = frame.size ? client_head(c) : 0;
+  c.active_ms = ms;
+}
 
-  rsm[4] = 0x03;
-  Serial.write(rsm, sizeof(rsm));
-  Serial.readBytes(buf, 5);
+// gives every client that wants a frame the one in capture, or the cached
+// one if it is fresh and new to the client, and so for the recorder
+void clients_attach(unsigned long ms) {
+  const bool joinable = frame_joinable(), fresh = frame_fresh(ms);
+  if (recorder_wants(ms) &&
+      frame_matches(CAMERA_DOWNSIZE, CAMERA_COMPRESSION) &&
+      (joinable || (fresh && recorder.frame_seq != frame.seq)))
+    recorder_attach(ms);
+  for (struct Client &c : clients) {
+    if (!client_wants(c, ms) || !frame_matches(c.downsize, c.compression) ||
+        !(joinable || (fresh && c.seq != frame.seq)))
+      continue;
+    if (fresh)
+      ++counters.cached;
+    client_attach(c, ms);
+  }
+}
+
+// answers the long-polls that saw motion or timed out; those that want
+// frames become streams of them, starting with the one kept from before
+void clients_motion(unsigned long ms) {
+  for (struct Client &c : clients) {
+    if (c.kind != CLIENT_MOTION)
+      continue;
+    if (motion.seq == c.since) {
+      if ((long)(ms - c.due) < 0)
+        continue;
+      c.client.print("HTTP/1.1 204 No Content\r\nConnection: close\r\n\r\n");
+      client_close(c);
+      continue;
+    }
+    ++counters.motions;
+    char res[160];
+    if (!c.pre && !c.post) {
+      char body[48];
+      const int len = snprintf(body, sizeof(body), "event %lu\ntime %ld\n",
+                               motion.seq, (long)motion.time);
+      snprintf(res, sizeof(res),
+               "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n"
+               "Content-Length: %d\r\nConnection: close\r\n\r\n%s",
+               len, body);
+      c.client.print(res);
+      client_close(c);
+      continue;
+    }
+    snprintf(res, sizeof(res),
+             "HTTP/1.1 200 OK\r\nContent-Type: multipart/x-mixed-replace; "
+             "boundary=" STREAM_BOUNDARY "\r\nX-Motion-Event: %lu\r\n"
+             "Connection: close\r\n\r\n",
+             motion.seq);
+    c.client.print(res);
+    c.kind = CLIENT_STREAM;
+    c.frames = c.post;
+    c.seq = frame.seq; // the kept frame is from before
+    c.due = ms;
+    if (c.pre && frame_matches(c.downsize, c.compression) &&
+        (frame_joinable() || (frame.complete && frame.buffered &&
+                              motion.ms - frame.captured_ms < c.interval))) {
+      ++c.frames;
+      client_attach(c, ms);
+      c.due = ms; // the frames after follow right away
+    }
+    if (!c.frames) { // nothing kept, and none wanted after
+      c.client.print("--" STREAM_BOUNDARY "--\r\n");
+      client_close(c);
+    }
+  }
+}
+
+// takes the settings of the next frame from the waiting clients in turn, or
+// else the recorder's
+void clients_settings(unsigned long ms) {
+  for (uint8_t i = 1; i <= CLIENT_MAX; i++) {
+    const uint8_t turn = (camera.turn + i) % CLIENT_MAX;
+    const struct Client &c = clients[turn];
+    if (client_wants(c, ms) || client_preroll(c, ms)) {
+      camera.turn = turn;
+      frame.downsize = c.downsize;
+      frame.compression = c.compression;
+      return;
+    }
+  }
+  frame.downsize = CAMERA_DOWNSIZE;
+  frame.compression = CAMERA_COMPRESSION;
+}
+
+bool clients_waiting(unsigned long ms) {
+  for (const struct Client &c : clients)
+    if (client_wants(c, ms) || client_preroll(c, ms))
+      return true;
+  return recorder_wants(ms);
+}
+
+uint8_t clients_recipients() {
+  uint8_t count = recorder.recipient;
+  for (const struct Client &c : clients)
+    count += c.recipient;
+  return count;
+}
+
+// whether every recipient has been sent all that was read of the frame
+bool clients_caught_up() {
+  for (const struct Client &c : clients)
+    if (c.recipient && c.offset < frame.filled)
+      return false;
+  return !recorder.recipient || recorder.offset == frame.filled;
+}
+
+// the frame size is known
+void clients_begin() {
+  for (struct Client &c : clients)
+    if (c.recipient)
+      c.head_len = client_head(c);
+  if (recorder.recipient)
+    recorder_begin();
+}
+
+// writes as much of the header and the frame to each recipient as its TCP
+// send buffer takes, never blocking, and a block of it to flash when it is
+// recorded; returns whether anything was written
+bool clients_send(unsigned long ms) {
+  bool sent = recorder_write();
+  for (struct Client &c : clients) {
+    if (c.kind == CLIENT_ARCHIVE) {
+      sent |= archive_send(c, ms);
+      continue;
+    }
+    if (!c.recipient || !c.head_len)
+      continue;
+    if (!c.client.connected()) {
+      client_drop(c);
+      continue;
+    }
+    if (c.head_sent == c.head_len && c.offset == frame.filled) {
+      c.active_ms = ms; // waiting on the camera
+      continue;
+    }
+    size_t room = c.client.availableForWrite();
+    if (!room) {
+      if (ms - c.active_ms > CLIENT_TIMEOUT) {
+        ++counters.stalls;
+        client_drop(c);
+      }
+      continue;
+    }
+    if (c.head_sent < c.head_len) {
+      const size_t w = c.client.write((const uint8_t *)c.head + c.head_sent,
+                                      _min(room, (size_t)(c.head_len -
+                                                          c.head_sent)));
+      c.head_sent += w;
+      room -= w;
+      metrics.client_bytes += w;
+    }
+    if (room && c.head_sent == c.head_len && c.offset < FRAME_STAMP_AT) {
+      const size_t w = c.client.write(
+          frame.buf + (c.offset - frame.base),
+          _min(room, (size_t)(_min(frame.filled, (uint32_t)FRAME_STAMP_AT) -
+                              c.offset)));
+      c.offset += w;
+      room -= w;
+      metrics.client_bytes += w;
+    }
+    if (room && c.offset == FRAME_STAMP_AT &&
+        c.stamp_sent < frame.stamp_len) {
+      const size_t w = c.client.write(
+          frame.stamp + c.stamp_sent,
+          _min(room, (size_t)(frame.stamp_len - c.stamp_sent)));
+      c.stamp_sent += w;
+      room -= w;
+      metrics.client_bytes += w;
+    }
+    if (room && c.offset >= FRAME_STAMP_AT && c.offset < frame.filled &&
+        c.stamp_sent == frame.stamp_len) {
+      const size_t w =
+          c.client.write(frame.buf + (c.offset - frame.base),
+                         _min(room, (size_t)(frame.filled - c.offset)));
+      c.offset += w;
+      metrics.client_bytes += w;
+    }
+    c.active_ms = ms;
+    sent = true;
+    if (c.head_sent < c.head_len || c.offset < frame.size)
+      continue;
+    if (c.kind == CLIENT_IMAGE) {
+      histogram_add(metrics.response, ms - c.queued_ms);
+      client_close(c);
+    } else if (c.frames && !--c.frames) {
+      c.client.print("\r\n--" STREAM_BOUNDARY "--\r\n");
+      client_close(c);
+    } else {
+      c.recipient = false;
+    }
+  }
+  return sent;
+}
+
+// image requests not yet answered get the error, others are cut off; a
+// stream between frames tries again with its next one
+void clients_fail(const char *error) {
+  for (struct Client &c : clients) {
+    if (!c.recipient)
+      continue;
+    if (c.head_sent) {
+      client_drop(c);
+    } else if (c.kind == CLIENT_IMAGE) {
+      char res[128];
+      snprintf(res, sizeof(res),
+               "HTTP/1.1 500 Internal Server Error\r\n"
+               "Content-Type: text/plain\r\nContent-Length: %u\r\n"
+               "Connection: close\r\n\r\n%s",
+               (unsigned)strlen(error), error);
+      c.client.print(res);
+      client_close(c);
+    } else {
+      c.recipient = false;
+    }
+  }
+  if (recorder.recipient) {
+    ++recorder.skipped;
+    recorder_fail();
+  }
+}
+
+// abandons the frame; the camera is drained and then goes to the next state
+void camera_fail(const char *error, uint8_t next) {
+  ++counters.failures;
+  frame.failed = true;
+  clients_fail(error);
+  camera.next = next;
+  camera_enter(CAMERA_DRAIN);
+}
+
+void camera_retry() {
+  ++transfer_slot().retries;
+  ++counters.retries;
+  if (++camera.retries > CAMERA_RETRIES) {
+    camera_fail("Transfer failed", CAMERA_RELEASE);
+    return;
+  }
+  camera.next = CAMERA_READ;
+  camera_enter(CAMERA_DRAIN);
+}
+
+// advances the capture and transfer of a frame by a step; returns false
+// when waiting on the camera or the clients
+bool camera_step() {
+
+  uint8_t res[9];
+  int8_t r;
+
+  const unsigned long ms = millis();
+
+  clients_poll(ms);
+  clients_motion(ms);
+  clients_attach(ms);
+
+  switch (camera.state) {
+  case CAMERA_IDLE: {
+    if (Serial.available() >= 5) { // motion, or a stray reply
+      Serial.readBytes(res, 5);
+      motion_reported(res);
+      return true;
+    }
+    // the cache can't be refilled while it is being sent
+    if (!clients_waiting(ms) || clients_recipients())
+      return false;
+    ++frame.seq;
+    frame.size = frame.filled = frame.base = frame.stamp_len = 0;
+    frame.buffered = frame.complete = frame.failed = false;
+    clients_settings(ms);
+    if (!camera_configure())
+      camera_resume();
+    return true;
+  }
+  case CAMERA_CONFIG:
+    if (!(r = camera_poll(res, 5, camera.command)))
+      return false;
+    if (r < 0) {
+      camera_fail("Failed to configure camera", CAMERA_IDLE);
+      return true;
+    }
+    if (camera.command == 0x54)
+      config.downsize = frame.downsize;
+    else
+      config.compression = frame.compression;
+    if (!camera_configure())
+      camera_resume();
+    return true;
+  case CAMERA_RESUME: {
+    if (!(r = camera_poll(res, 5, 0x36)))
+      return false;
+    if (r < 0) {
+      camera_fail("Failed to move to next frame", CAMERA_IDLE);
+      return true;
+    }
+    frame.captured_ms = ms;
+    frame.time = time(nullptr);
+    snprintf(frame.etag, sizeof(frame.etag), "\"%lx-%lx\"",
+             (unsigned long)frame.time, ms);
+    frame_stamp();
+    uint8_t takephoto[] = {0x56, 0x00, 0x36, 0x01, 0x00};
+    Serial.write(takephoto, sizeof(takephoto));
+    camera_enter(CAMERA_CAPTURE);
+    return true;
+  }
+  case CAMERA_CAPTURE: {
+    if (!(r = camera_poll(res, 5, 0x36)))
+      return false;
+    if (r < 0) {
+      camera_fail("Failed to take picture", CAMERA_RELEASE);
+      return true;
+    }
+    uint8_t bufflen[] = {0x56, 0x00, 0x34, 0x01, 0x00};
+    Serial.write(bufflen, sizeof(bufflen));
+    camera_enter(CAMERA_LENGTH);
+    return true;
+  }
+  case CAMERA_LENGTH:
+    if (!(r = camera_poll(res, 9, 0x34)))
+      return false;
+    frame.size = r < 0 ? 0
+                       : (uint32_t)res[5] << 24 | (uint32_t)res[6] << 16 |
+                             (uint32_t)res[7] << 8 | res[8];
+    if (frame.size == 0) {
+      camera_fail("Picture is -zero- bytes in size", CAMERA_RELEASE);
+      return true;
+    }
+    histogram_add(metrics.capture, ms - frame.captured_ms);
+    frame.buffered = frame.size <= FRAME_CACHE_SIZE;
+    clients_begin();
+    camera.n = _min((uint32_t)camera.chunk, frame.size);
+    camera.retries = 0;
+    camera_request(camera.n);
+    camera_enter(CAMERA_READ);
+    return true;
+  case CAMERA_READ:
+    // a chunk with header and trailer, at 10 bits per byte, and some slack
+    if ((size_t)Serial.available() < camera.n + 10u) {
+      if (ms - camera.request_ms <=
+          50 + 10000ul * (camera.n + 10) / camera.baud)
+        return false;
+      ++counters.timeouts;
+      camera_retry();
+      return true;
+    }
+    Serial.readBytes(res, 5);
+    if (motion_reported(res))
+      return true;
+    if (res[0] != 0x76 || res[2] != 0x32 || res[3] != 0x00) {
+      camera_retry();
+      return true;
+    }
+    if (!frame.buffered) // all recipients have the previous chunk
+      frame.base = frame.filled;
+    Serial.readBytes(frame.buf + (frame.filled - frame.base), camera.n);
+    Serial.readBytes(res, 5);
+    // a byte lost from the chunk pulls in the next reply, which the trailer
+    // gives away
+    if (res[0] != 0x76 || res[2] != 0x32 || res[3] != 0x00) {
+      camera_retry();
+      return true;
+    }
+    camera.retries = 0;
+    frame.filled += camera.n;
+    if (frame.filled < frame.size) // the camera fills the receive buffer
+      camera_request(                // while this chunk goes out
+          _min((uint32_t)camera.chunk, frame.size - frame.filled));
+    camera_enter(CAMERA_SEND);
+    return true;
+  case CAMERA_SEND:
+    if (!frame.buffered) {
+      if (!clients_recipients()) { // all gone, drop the rest of the frame
+        frame.failed = true;
+        camera.next = CAMERA_RELEASE;
+        camera_enter(CAMERA_DRAIN);
+        return true;
+      }
+      if (!clients_caught_up())
+        return false;
+    }
+    if (frame.filled < frame.size) {
+      camera.n = _min((uint32_t)camera.chunk, frame.size - frame.filled);
+      camera_enter(CAMERA_READ);
+      return true;
+    }
+    {
+      struct TransferStats &stats = transfer_slot();
+      const unsigned long latency = ms - frame.captured_ms;
+      ++stats.count;
+      stats.bytes += frame.size;
+      stats.sum_ms += latency;
+      stats.min_ms = _min(stats.min_ms, latency);
+      stats.max_ms = _max(stats.max_ms, latency);
+      histogram_add(metrics.transfer, latency);
+      metrics.camera_bytes += frame.size;
+    }
+    frame.complete = true;
+    camera_release();
+    return true;
+  case CAMERA_DRAIN:
+    if (Serial.available()) {
+      while (Serial.available())
+        Serial.read();
+      camera.state_ms = ms;
+      return false;
+    }
+    if (ms - camera.state_ms < 20)
+      return false;
+    if (camera.next == CAMERA_READ) {
+      camera_request(camera.n);
+      camera_enter(CAMERA_READ);
+    } else if (camera.next == CAMERA_RELEASE) {
+      camera_release();
+    } else {
+      camera_enter(CAMERA_IDLE);
+    }
+    return true;
+  case CAMERA_RELEASE:
+    if (!(r = camera_poll(res, 5, 0x36)))
+      return false;
+    camera.next = CAMERA_IDLE;
+    camera_enter(r < 0 ? CAMERA_DRAIN : CAMERA_IDLE);
+    return true;
+  }
+  return false;
+}
+
+// queues the client of the current request for a frame, which
+// clients_send() writes the response for
+struct Client *client_queue(uint8_t kind) {
+
+  for (struct Client &c : clients) {
+    if (c.kind != CLIENT_NONE)
+      continue;
+    c.client = server.client();
+    c.client.setNoDelay(true);
+    c.kind = kind;
+    c.recipient = false;
+    c.seq = 0;
+    c.since = motion.seq;
+    c.interval = 0;
+    c.frames = c.pre = c.post = 0;
+    c.due = c.active_ms = c.queued_ms = millis();
+    c.downsize = CAMERA_DOWNSIZE;
+    c.compression = CAMERA_COMPRESSION;
+    return &c;
+  }
+
+  ++counters.rejected;
+  server.sendHeader("Retry-After", "1");
+  server.send(503, "text/plain", "Too many clients");
+  return nullptr;
+}
+
+// reads the picture size from the 'size' argument, 640x480, 320x240, or
+// 160x120, and the compression ratio from 'q', 0 to 255, with higher values
+// giving smaller images; answers 400 to others
+bool request_settings(uint8_t &downsize, uint8_t &compression) {
+
+  static const uint8_t downsizes[] = {0x00, 0x11, 0x22};
+
+  downsize = CAMERA_DOWNSIZE;
+  compression = CAMERA_COMPRESSION;
+
+  if (server.hasArg("size")) {
+    uint8_t i = 0;
+    while (i < sizeof(downsizes) &&
+           server.arg("size") != camera_resolution(downsizes[i]))
+      ++i;
+    if (i == sizeof(downsizes)) {
+      server.send(400, "text/plain", "Unsupported size");
+      return false;
+    }
+    downsize = downsizes[i];
+  }
+
+  if (server.hasArg("q")) {
+    const long q = server.arg("q").toInt();
+    if (q < 0 || q > 255 || (q == 0 && server.arg("q") != "0")) {
+      server.send(400, "text/plain", "Unsupported compression");
+      return false;
+    }
+    compression = q;
+  }
+
+  return true;
+}
+
+// a poller that has the cached frame gets a 304
+void JPEGPicture() {
+
+  uint8_t downsize, compression;
+  if (!request_settings(downsize, compression))
+    return;
+
+  if (frame_fresh(millis()) && frame_matches(downsize, compression) &&
+      server.header("If-None-Match") == frame.etag) {
+    ++counters.unchanged;
+    server.sendHeader("ETag", frame.etag);
+    server.send(304, "text/plain", "");
+    return;
+  }
+
+  struct Client *c = client_queue(CLIENT_IMAGE);
+  if (!c)
+    return;
+
+  c->downsize = downsize;
+  c->compression = compression;
+}
+
+// Serves frames back-to-back as multipart/x-mixed-replace over a single
+// connection, at the frame rate given by the 'fps' argument, STREAM_FPS by
+// default, also when it is not a positive number, and capped at
+// STREAM_FPS_MAX. Frames that take longer than the interval go out as soon as
+// they are ready.
+void MJPEGStream() {
+
+  float fps = STREAM_FPS;
+  if (server.hasArg("fps"))
+    fps = server.arg("fps").toFloat();
+  if (fps <= 0.0f)
+    fps = STREAM_FPS;
+  else if (fps > STREAM_FPS_MAX)
+    fps = STREAM_FPS_MAX;
+
+  uint8_t downsize, compression;
+  if (!request_settings(downsize, compression))
+    return;
+
+  struct Client *c = client_queue(CLIENT_STREAM);
+  if (!c)
+    return;
+
+  c->interval = 1000.0f / fps;
+  c->downsize = downsize;
+  c->compression = compression;
+  c->client.print("HTTP/1.1 200 OK\r\n"
+                  "Content-Type: multipart/x-mixed-replace; "
+                  "boundary=" STREAM_BOUNDARY "\r\n"
+                  "Cache-Control: no-cache\r\n"
+                  "Connection: close\r\n\r\n");
+}
+
+// Long-polls for motion, for up to 'timeout' seconds, MOTION_TIMEOUT by
+// default, and answers 204 if there was none. An event newer than 'since'
+// answers right away with its number and time. With 'pre' or 'post', the
+// answer to the next event is instead a multipart stream of the kept frame
+// from before it and of the frames after it, 'interval' ms apart.
+void MotionPoll() {
+
+  long timeout = MOTION_TIMEOUT;
+  if (server.hasArg("timeout"))
+    timeout = server.arg("timeout").toInt();
+  if (timeout <= 0)
+    timeout = MOTION_TIMEOUT;
+  if (timeout > MOTION_TIMEOUT_MAX)
+    timeout = MOTION_TIMEOUT_MAX;
+
+  const long pre = server.hasArg("pre") ? server.arg("pre").toInt() : 0,
+             post = server.hasArg("post") ? server.arg("post").toInt() : 0;
+  if (pre < 0 || pre > MOTION_PRE_MAX || post < 0 || post > MOTION_POST_MAX) {
+    server.send(400, "text/plain", "Unsupported frame count");
+    return;
+  }
+
+  long interval = MOTION_INTERVAL;
+  if (server.hasArg("interval"))
+    interval = server.arg("interval").toInt();
+  if (interval < 1000.0f / STREAM_FPS_MAX)
+    interval = 1000.0f / STREAM_FPS_MAX;
+
+  struct Client *c = client_queue(CLIENT_MOTION);
+  if (!c)
+    return;
+
+  // a 'since' beyond the last event is from before a reboot
+  if (!pre && !post && server.hasArg("since"))
+    c->since = _min(strtoul(server.arg("since").c_str(), nullptr, 10),
+                    motion.seq);
+  c->pre = pre;
+  c->post = post;
+  c->interval = interval;
+  c->due = millis() + timeout * 1000ul;
+}
+
+// Sends the frames recorded between the unix times 'from' and 'to' as a tar
+// archive, one download at a time. The frames it still has to send are not
+// removed to make room, so recording may skip frames meanwhile.
+void RecordArchive() {
+
+  if (!recorder.mounted) {
+    server.send(503, "text/plain", "No storage");
+    return;
+  }
+
+  if (archive.active) {
+    server.sendHeader("Retry-After", "10");
+    server.send(503, "text/plain", "Archive busy");
+    return;
+  }
+
+  struct Client *c = client_queue(CLIENT_ARCHIVE);
+  if (!c)
+    return;
+
+  archive.from = server.hasArg("from")
+                     ? strtoul(server.arg("from").c_str(), nullptr, 10)
+                     : 0ul;
+  archive.to = server.hasArg("to")
+                   ? strtoul(server.arg("to").c_str(), nullptr, 10)
+                   : ~0ul;
+  archive.last = recorder.seq;
+  archive.seq =
+      recorder.seq > RECORD_SLOTS ? recorder.seq - RECORD_SLOTS : 0;
+  archive.left = 0;
+  archive.trailer = 2;
+  archive.sent = sizeof(archive.buf);
+  archive.active = true;
+
+  unsigned long length = archive.trailer * sizeof(archive.buf);
+  for (uint32_t seq = archive.seq; (seq = archive_next(seq));)
+    length += sizeof(archive.buf) +
+              ((recorder.index[seq % RECORD_SLOTS].size + 511) & ~511ul);
+
+  char res[192];
+  snprintf(res, sizeof(res),
+           "HTTP/1.1 200 OK\r\nContent-Type: application/x-tar\r\n"
+           "Content-Length: %lu\r\nContent-Disposition: attachment; "
+           "filename=\"nitecam.tar\"\r\nConnection: close\r\n\r\n",
+           length);
+  c->client.print(res);
 }
 
 void setup() {
@@ -200,18 +1836,33 @@ void setup() {
 
   ArduinoOTA.onEnd([]() {});
 
-  ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {});
+  ArduinoOTA.onProgress([](unsigned int, unsigned int) {});
 
-  ArduinoOTA.onError([](ota_error_t error) {});
+  ArduinoOTA.onError([](ota_error_t) {});
 
   ArduinoOTA.begin();
 
   server.on("/status", VC0706Status);
 
+  server.on("/transfer", TransferConfig);
+
+  server.on("/stream", MJPEGStream);
+
+  server.on("/motion", MotionPoll);
+
+  server.on("/metrics", Metrics);
+
+  server.on("/archive", RecordArchive);
+
   server.on("/", JPEGPicture);
 
+  const char *headers[] = {"If-None-Match"};
+  server.collectHeaders(headers, 1);
+
   server.onNotFound(JPEGPicture);
 
+  record_init();
+
   VC0706_init();
 
   delay(2000);
@@ -224,4 +1875,12 @@ void loop() {
   ArduinoOTA.handle();
 
   server.handleClient();
+
+  metrics_rate(millis());
+
+  for (uint8_t i = 0; i < CAMERA_STEPS; i++) {
+    const bool sent = clients_send(millis());
+    if (!camera_step() && !sent)
+      break;
+  }
 }
@@ -0,0 +1,122 @@
+/**
+ *  @file    Arduino.h
+ *  @brief   Host Stand-In for the ESP32 Arduino Core
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *
+ ***********************************************/
+
+#ifndef EMULATOR_ARDUINO_H
+#define EMULATOR_ARDUINO_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <poll.h>
+#include <unistd.h>
+
+#define LED_BUILTIN 2
+#define OUTPUT 0x03
+#define LOW 0x0
+#define HIGH 0x1
+
+#define _min(a, b) ((a) < (b) ? (a) : (b))
+#define _max(a, b) ((a) > (b) ? (a) : (b))
+
+inline const std::chrono::steady_clock::time_point emulator_epoch =
+    std::chrono::steady_clock::now();
+
+inline unsigned long micros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - emulator_epoch)
+      .count();
+}
+
+inline unsigned long millis() { return micros() / 1000ul; }
+
+inline void delay(unsigned long ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline double ledcSetup(uint8_t, double freq, uint8_t) { return freq; }
+inline void ledcAttachPin(uint8_t, uint8_t) {}
+inline void ledcWrite(uint8_t, uint32_t) {}
+
+// reads from in_fd and writes to out_fd, both default to stdio; output can be
+// silenced for benchmarking
+class HardwareSerial {
+public:
+  int in_fd = -1;
+  int out_fd = STDOUT_FILENO;
+  bool quiet = false;
+  size_t tx_bytes = 0;
+
+  void begin(unsigned long) {}
+  void setRxBufferSize(size_t) {}
+
+  int available() {
+    if (in_fd < 0)
+      return 0;
+    if (pending < 0) {
+      struct pollfd pfd = {in_fd, POLLIN, 0};
+      uint8_t c;
+      if (poll(&pfd, 1, 0) > 0 && ::read(in_fd, &c, 1) == 1)
+        pending = c;
+    }
+    return pending < 0 ? 0 : 1;
+  }
+
+  int read() {
+    if (!available())
+      return -1;
+    int c = pending;
+    pending = -1;
+    return c;
+  }
+
+  size_t readBytes(uint8_t *buf, size_t len) {
+    size_t n = 0;
+    while (n < len && available())
+      buf[n++] = read();
+    return n;
+  }
+
+  size_t readBytes(char *buf, size_t len) {
+    return readBytes((uint8_t *)buf, len);
+  }
+
+  size_t write(const uint8_t *buf, size_t len) {
+    tx_bytes += len;
+    if (quiet || out_fd < 0)
+      return len;
+    return ::write(out_fd, buf, len) < 0 ? 0 : len;
+  }
+
+  size_t write(uint8_t c) { return write(&c, 1); }
+
+  size_t print(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+  size_t print(const std::string &s) { return print(s.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned long v) { return print(std::to_string(v)); }
+  size_t print(long v) { return print(std::to_string(v)); }
+  size_t print(unsigned int v) { return print((unsigned long)v); }
+  size_t print(int v) { return print((long)v); }
+
+  template <typename T> size_t println(T v) { return print(v) + print('\n'); }
+  size_t println() { return print('\n'); }
+
+private:
+  int pending = -1;
+};
+
+inline HardwareSerial Serial;
+
+#endif // EMULATOR_ARDUINO_H
@@ -0,0 +1,119 @@
+/**
+ *  @file    SPIFFS.h
+ *  @brief   Host Stand-In for SPIFFS, Backed by a Local Directory
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *
+ ***********************************************/
+
+#ifndef EMULATOR_SPIFFS_H
+#define EMULATOR_SPIFFS_H
+
+#include "Arduino.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+class File {
+public:
+  File() = default;
+
+  File(const std::string &path, const std::string &name, const char *mode)
+      : name_(name) {
+    if (std::filesystem::is_directory(path)) {
+      for (const auto &entry : std::filesystem::directory_iterator(path))
+        if (entry.is_regular_file())
+          entries_.push_back(entry.path().filename().string());
+      std::sort(entries_.begin(), entries_.end());
+      path_ = path;
+      directory_ = true;
+      return;
+    }
+    FILE *fp = std::fopen(path.c_str(), mode[0] == 'w' ? "wb" : "rb");
+    if (fp)
+      fp_ = std::shared_ptr<FILE>(fp, std::fclose);
+  }
+
+  operator bool() const { return fp_ || directory_; }
+
+  const char *name() const { return name_.c_str(); }
+
+  size_t size() const {
+    if (!fp_)
+      return 0;
+    long pos = std::ftell(fp_.get());
+    std::fseek(fp_.get(), 0, SEEK_END);
+    long end = std::ftell(fp_.get());
+    std::fseek(fp_.get(), pos, SEEK_SET);
+    return end;
+  }
+
+  size_t readBytes(char *buf, size_t len) {
+    return fp_ ? std::fread(buf, 1, len, fp_.get()) : 0;
+  }
+
+  size_t write(const uint8_t *buf, size_t len) {
+    return fp_ ? std::fwrite(buf, 1, len, fp_.get()) : 0;
+  }
+
+  File openNextFile(const char *mode = "r") {
+    if (!directory_ || next_ >= entries_.size())
+      return File();
+    const std::string &entry = entries_[next_++];
+    return File(path_ + "/" + entry, "/" + entry, mode);
+  }
+
+  void close() {
+    fp_.reset();
+    directory_ = false;
+  }
+
+private:
+  std::shared_ptr<FILE> fp_;
+  std::string name_;
+  std::string path_;
+  std::vector<std::string> entries_;
+  size_t next_ = 0;
+  bool directory_ = false;
+};
+
+class SPIFFSFS {
+public:
+  std::string root = ".";
+  size_t total = 1408u * 1024u; // default ESP32 partition
+
+  bool begin(bool = false) { return std::filesystem::is_directory(root); }
+
+  File open(const char *path, const char *mode = "r") {
+    return File(root + path, path, mode);
+  }
+
+  bool exists(const char *path) {
+    return std::filesystem::exists(root + path);
+  }
+
+  bool remove(const char *path) { return std::filesystem::remove(root + path); }
+
+  bool rename(const char *from, const char *to) {
+    std::error_code ec;
+    std::filesystem::rename(root + from, root + to, ec);
+    return !ec;
+  }
+
+  size_t totalBytes() { return total; }
+
+  size_t usedBytes() {
+    size_t used = 0;
+    for (const auto &entry : std::filesystem::directory_iterator(root))
+      if (entry.is_regular_file())
+        used += entry.file_size();
+    return std::min(used, total);
+  }
+};
+
+inline SPIFFSFS SPIFFS;
+
+#endif // EMULATOR_SPIFFS_H
@@ -0,0 +1,92 @@
+/**
+ *  @file    TFT_eSPI.h
+ *  @brief   Host Stand-In for TFT_eSPI, Rendering into a Framebuffer
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *
+ ***********************************************/
+
+#ifndef EMULATOR_TFT_ESPI_H
+#define EMULATOR_TFT_ESPI_H
+
+#include "Arduino.h"
+
+#include <fstream>
+#include <vector>
+
+#define TFT_WIDTH 240
+#define TFT_HEIGHT 320
+
+#define TFT_BLACK 0x0000
+
+class TFT_eSPI {
+public:
+  struct {
+    unsigned long calls;
+    unsigned long pixels;
+  } dma = {0, 0};
+
+  void init() { setRotation(0); }
+
+  void setRotation(uint8_t r) {
+    width_ = r & 1 ? TFT_HEIGHT : TFT_WIDTH;
+    height_ = r & 1 ? TFT_WIDTH : TFT_HEIGHT;
+    framebuffer_.assign(width_ * height_, TFT_BLACK);
+  }
+
+  int16_t width() const { return width_; }
+  int16_t height() const { return height_; }
+
+  void setSwapBytes(bool swap) { swap_ = swap; }
+
+  void fillScreen(uint16_t color) {
+    std::fill(framebuffer_.begin(), framebuffer_.end(), color);
+  }
+
+  bool initDMA(bool = false) { return true; }
+
+  // records the transfer, the panel would receive it byte-swapped when
+  // swap_ is set, so the framebuffer holds the colors as drawn
+  void pushImageDMA(int32_t x, int32_t y, int32_t w, int32_t h,
+                    uint16_t *data) {
+    ++dma.calls;
+    dma.pixels += w * h;
+    for (int32_t j = 0; j < h; j++) {
+      if (y + j < 0 || y + j >= height_)
+        continue;
+      for (int32_t i = 0; i < w; i++) {
+        if (x + i < 0 || x + i >= width_)
+          continue;
+        uint16_t c = data[j * w + i];
+        if (!swap_)
+          c = (c >> 8) | (c << 8);
+        framebuffer_[(y + j) * width_ + x + i] = c;
+      }
+    }
+  }
+
+  void dmaWait() {}
+
+  bool writePPM(const std::string &path) const {
+    std::ofstream ofs(path, std::ios::binary);
+    if (!ofs)
+      return false;
+    ofs << "P6\n" << width_ << ' ' << height_ << "\n255\n";
+    for (uint16_t c : framebuffer_) {
+      uint8_t r = (c >> 11) & 0x1F, g = (c >> 5) & 0x3F, b = c & 0x1F;
+      ofs.put((r << 3) | (r >> 2));
+      ofs.put((g << 2) | (g >> 4));
+      ofs.put((b << 3) | (b >> 2));
+    }
+    return static_cast<bool>(ofs);
+  }
+
+private:
+  int16_t width_ = TFT_WIDTH;
+  int16_t height_ = TFT_HEIGHT;
+  bool swap_ = false;
+  std::vector<uint16_t> framebuffer_;
+};
+
+#endif // EMULATOR_TFT_ESPI_H
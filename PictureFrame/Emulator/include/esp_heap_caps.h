@@ -0,0 +1,41 @@
+/**
+ *  @file    esp_heap_caps.h
+ *  @brief   Host Stand-In for the ESP-IDF Capability Allocator
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *
+ ***********************************************/
+
+#ifndef EMULATOR_ESP_HEAP_CAPS_H
+#define EMULATOR_ESP_HEAP_CAPS_H
+
+#include <cstddef>
+#include <cstdlib>
+
+#define MALLOC_CAP_DMA (1 << 3)
+#define MALLOC_CAP_8BIT (1 << 2)
+
+// the host has no separate heaps, report the ESP32's nominal size instead
+#define EMULATOR_HEAP_SIZE (320u * 1024u)
+
+inline size_t emulator_heap_allocated = 0;
+
+inline void *heap_caps_malloc(size_t size, unsigned) {
+  emulator_heap_allocated += size;
+  return std::aligned_alloc(4, (size + 3) & ~size_t(3));
+}
+
+inline size_t heap_caps_get_free_size(unsigned) {
+  return EMULATOR_HEAP_SIZE - emulator_heap_allocated;
+}
+
+inline size_t heap_caps_get_minimum_free_size(unsigned caps) {
+  return heap_caps_get_free_size(caps);
+}
+
+inline size_t heap_caps_get_largest_free_block(unsigned caps) {
+  return heap_caps_get_free_size(caps);
+}
+
+#endif // EMULATOR_ESP_HEAP_CAPS_H
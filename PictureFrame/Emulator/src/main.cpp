@@ -0,0 +1,155 @@
+/**
+ *  @file    main.cpp
+ *  @brief   Picture Frame Host Emulator
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *  @details Builds the firmware against file-backed SPIFFS and a virtual TFT.
+ *           Renders every image in a directory and writes the resulting
+ *           framebuffers as PPM, replays them to benchmark the per-phase
+ *           render cost, or runs the firmware with Serial on a pseudo
+ *           terminal, e.g., for use with the uploader.
+ *
+ ***********************************************/
+
+#include "../../src/main.cpp"
+
+#include <fcntl.h>
+#include <getopt.h>
+
+#include <cstdlib>
+
+static const char *usage =
+    "usage: %s [-o ppm-dir] [-n repeat] [-s spi-MHz] [-p] image-dir\n"
+    "  -o  write each rendered frame as <ppm-dir>/<image>.ppm\n"
+    "  -n  replay every image this many times and report the average\n"
+    "  -s  SPI clock used to estimate the panel transfer time (40)\n"
+    "  -p  run setup()/loop() with Serial on a pseudo terminal\n";
+
+int run(const char *ppm_dir) {
+  int fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) {
+    std::perror("pty");
+    return 1;
+  }
+  std::fprintf(stderr, "serial on %s\n", ptsname(fd));
+
+  Serial.in_fd = Serial.out_fd = fd;
+
+  setup();
+
+  unsigned long calls = tft.dma.calls;
+  for (;;) {
+    loop();
+    if (ppm_dir && tft.dma.calls != calls) {
+      tft.writePPM(std::string(ppm_dir) + "/frame.ppm");
+      calls = tft.dma.calls;
+    }
+    delay(1);
+  }
+}
+
+int main(int argc, char *argv[]) {
+
+  const char *ppm_dir = nullptr;
+  unsigned long repeat = 1;
+  double spi_mhz = 40.0;
+  bool pty = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "o:n:s:p")) != -1) {
+    switch (opt) {
+    case 'o':
+      ppm_dir = optarg;
+      break;
+    case 'n':
+      repeat = std::strtoul(optarg, nullptr, 10);
+      break;
+    case 's':
+      spi_mhz = std::atof(optarg);
+      break;
+    case 'p':
+      pty = true;
+      break;
+    default:
+      std::fprintf(stderr, usage, argv[0]);
+      return 1;
+    }
+  }
+
+  if (optind >= argc || repeat == 0 || spi_mhz <= 0.0) {
+    std::fprintf(stderr, usage, argv[0]);
+    return 1;
+  }
+
+  SPIFFS.root = argv[optind];
+
+  if (pty)
+    return run(ppm_dir);
+
+  Serial.quiet = repeat > 1;
+
+  if (!SPIFFS.begin()) {
+    std::fprintf(stderr, "'%s' is not a directory\n", argv[optind]);
+    return 1;
+  }
+
+  tft.init();
+  tft.setRotation(1);
+  tft.setSwapBytes(true);
+  tft.initDMA(true);
+
+  if (!dma_pool_init())
+    return 1;
+
+  std::printf("%-24s %8s %8s %8s %8s %8s %8s %10s\n", "image", "open",
+              "header", "read", "convert", "dma", "total", "spi(est)");
+
+  double sum[PHASE_NUMBER] = {0.0}, sum_spi = 0.0;
+  unsigned long rendered = 0;
+
+  File root = SPIFFS.open("/", "r");
+  File file;
+  while ((file = root.openNextFile("r"))) {
+    std::string name = file.name();
+    file.close();
+
+    stats_reset();
+    tft.fillScreen(TFT_BLACK);
+    unsigned long pixels = tft.dma.pixels;
+
+    for (unsigned long i = 0; i < repeat; i++)
+      if (!drawbmp(name.c_str()))
+        break;
+
+    if (render_stats[PHASE_TOTAL].count == 0) {
+      std::printf("%-24s %s\n", name.c_str(), "not rendered");
+      continue;
+    }
+
+    double spi = (tft.dma.pixels - pixels) * 16.0 / spi_mhz /
+                 render_stats[PHASE_TOTAL].count;
+
+    std::printf("%-24s", name.c_str());
+    for (uint8_t i = 0; i < PHASE_NUMBER; i++) {
+      double avg = (double)render_stats[i].sum / render_stats[i].count;
+      sum[i] += avg;
+      std::printf(" %8.0f", avg);
+    }
+    std::printf(" %10.0f\n", spi);
+    sum_spi += spi;
+    ++rendered;
+
+    if (ppm_dir)
+      tft.writePPM(std::string(ppm_dir) + name + ".ppm");
+  }
+
+  if (rendered) {
+    std::printf("%-24s", "average (us)");
+    for (uint8_t i = 0; i < PHASE_NUMBER; i++)
+      std::printf(" %8.0f", sum[i] / rendered);
+    std::printf(" %10.0f\n", sum_spi / rendered);
+  }
+
+  return 0;
+}
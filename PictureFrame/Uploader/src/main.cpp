@@ -0,0 +1,290 @@
+/**
+ *  @file    main.cpp
+ *  @brief   Picture Frame Serial Image Uploader
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *
+ ***********************************************/
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/select.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "../../src/Upload.h"
+
+static int fd = -1;
+
+speed_t baud_to_speed(long baud) {
+  switch (baud) {
+  case 115200:
+    return B115200;
+  case 230400:
+    return B230400;
+#ifdef B460800
+  case 460800:
+    return B460800;
+#endif
+#ifdef B921600
+  case 921600:
+    return B921600;
+#endif
+  }
+  return B0;
+}
+
+bool serial_open(const char *port, long baud) {
+  speed_t speed = baud_to_speed(baud);
+  if (speed == B0) {
+    std::fprintf(stderr, "unsupported baud rate %ld\n", baud);
+    return false;
+  }
+
+  fd = open(port, O_RDWR | O_NOCTTY);
+  if (fd < 0) {
+    std::fprintf(stderr, "failed to open '%s': %s\n", port,
+                 std::strerror(errno));
+    return false;
+  }
+
+  struct termios tio;
+  tcgetattr(fd, &tio);
+  cfmakeraw(&tio);
+  cfsetispeed(&tio, speed);
+  cfsetospeed(&tio, speed);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cflag &= ~CRTSCTS;
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 0;
+  tcsetattr(fd, TCSANOW, &tio);
+  tcflush(fd, TCIOFLUSH);
+
+  return true;
+}
+
+void serial_write(const uint8_t *data, size_t len) {
+  while (len) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0) {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      std::perror("write");
+      std::exit(1);
+    }
+    data += n;
+    len -= n;
+  }
+}
+
+void send_frame(uint8_t type, uint16_t seq, const uint8_t *payload,
+                uint16_t len) {
+  struct UploadHeader hdr = {UPLOAD_SYNC, type, seq, len, 0};
+  hdr.crc = upload_crc(&hdr, payload);
+  serial_write((const uint8_t *)&hdr, sizeof(hdr));
+  if (len)
+    serial_write(payload, len);
+}
+
+bool serial_read(uint8_t *data, size_t len, long timeout_ms) {
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (len) {
+    auto left = std::chrono::duration_cast<std::chrono::microseconds>(
+                    deadline - std::chrono::steady_clock::now())
+                    .count();
+    if (left <= 0)
+      return false;
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+    struct timeval tv = {(time_t)(left / 1000000),
+                         (suseconds_t)(left % 1000000)};
+    if (select(fd + 1, &fds, nullptr, nullptr, &tv) <= 0)
+      continue;
+    ssize_t n = read(fd, data, len);
+    if (n > 0) {
+      data += n;
+      len -= n;
+    }
+  }
+  return true;
+}
+
+// returns the frame type, or 0 on timeout; anything else on the line, such as
+// log output from the frame, is skipped
+uint8_t recv_frame(uint16_t &seq, std::string &msg, long timeout_ms) {
+  struct UploadHeader hdr;
+  uint8_t payload[UPLOAD_BLOCK];
+  for (;;) {
+    if (!serial_read(&hdr.sync, 1, timeout_ms))
+      return 0;
+    if (hdr.sync != UPLOAD_SYNC)
+      continue;
+    if (!serial_read(&hdr.type, sizeof(hdr) - 1, timeout_ms))
+      return 0;
+    if (hdr.len > UPLOAD_BLOCK)
+      continue;
+    if (!serial_read(payload, hdr.len, timeout_ms))
+      return 0;
+    if (upload_crc(&hdr, payload) != hdr.crc)
+      continue;
+    seq = hdr.seq;
+    msg.assign((const char *)payload, hdr.len);
+    return hdr.type;
+  }
+}
+
+int main(int argc, char *argv[]) {
+
+  long baud = 115200;
+  int opt;
+  while ((opt = getopt(argc, argv, "b:")) != -1) {
+    if (opt == 'b')
+      baud = std::atol(optarg);
+    else
+      break;
+  }
+
+  if (argc - optind < 2) {
+    std::fprintf(stderr, "usage: %s [-b baud] port image.bmp [name]\n",
+                 argv[0]);
+    return 1;
+  }
+
+  const char *port = argv[optind], *path = argv[optind + 1];
+
+  std::string name;
+  if (argc - optind > 2)
+    name = argv[optind + 2];
+  else {
+    name = path;
+    size_t slash = name.find_last_of('/');
+    if (slash != std::string::npos)
+      name.erase(0, slash + 1);
+  }
+  if (name.empty() || name[0] != '/')
+    name.insert(0, "/");
+  if (name.size() > UPLOAD_NAME_MAX) {
+    std::fprintf(stderr, "name '%s' exceeds %d characters\n", name.c_str(),
+                 UPLOAD_NAME_MAX);
+    return 1;
+  }
+
+  std::ifstream ifs(path, std::ios::binary);
+  if (!ifs) {
+    std::fprintf(stderr, "failed to open '%s'\n", path);
+    return 1;
+  }
+  std::vector<uint8_t> data((std::istreambuf_iterator<char>(ifs)),
+                            std::istreambuf_iterator<char>());
+
+  if (!serial_open(port, baud))
+    return 1;
+
+  std::vector<uint8_t> open_payload(sizeof(uint32_t) + name.size());
+  uint32_t size = data.size();
+  std::memcpy(open_payload.data(), &size, sizeof(size));
+  std::memcpy(open_payload.data() + sizeof(size), name.data(), name.size());
+
+  uint16_t seq;
+  std::string msg;
+  uint8_t type = 0;
+  for (int retry = 0; retry < 3 && type != UPLOAD_ACK; retry++) {
+    send_frame(UPLOAD_OPEN, 0, open_payload.data(), open_payload.size());
+    type = recv_frame(seq, msg, 2000);
+    if (type == UPLOAD_ERROR) {
+      std::fprintf(stderr, "frame error: %s\n", msg.c_str());
+      return 1;
+    }
+  }
+  if (type != UPLOAD_ACK) {
+    std::fprintf(stderr, "no response from frame\n");
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  const uint32_t nblocks = (size + UPLOAD_BLOCK - 1) / UPLOAD_BLOCK;
+  uint32_t base = 0, next = 0, resent = 0, timeouts = 0;
+  while (base < nblocks) {
+    while (next < nblocks && next < base + UPLOAD_WINDOW) {
+      uint32_t offset = next * UPLOAD_BLOCK;
+      send_frame(UPLOAD_DATA, (uint16_t)next, data.data() + offset,
+                 std::min<uint32_t>(UPLOAD_BLOCK, size - offset));
+      ++next;
+    }
+
+    type = recv_frame(seq, msg, 1000);
+
+    // sequence numbers are 16-bit on the wire, extend relative to base
+    uint32_t abs = base + (uint16_t)(seq - (uint16_t)base);
+    switch (type) {
+    case UPLOAD_ACK:
+      if (abs > base && abs <= next) {
+        base = abs;
+        timeouts = 0;
+      }
+      break;
+    case UPLOAD_NAK:
+      if (abs >= base && abs <= next) {
+        resent += next - abs;
+        base = next = abs;
+      }
+      break;
+    case UPLOAD_ERROR:
+      std::fprintf(stderr, "\nframe error: %s\n", msg.c_str());
+      return 1;
+    case 0:
+      ++timeouts;
+      if (timeouts > 10) {
+        std::fprintf(stderr, "\nframe stopped responding\n");
+        return 1;
+      }
+      resent += next - base;
+      next = base;
+    }
+
+    std::fprintf(stderr, "\r%u/%u bytes", std::min(base * UPLOAD_BLOCK, size),
+                 size);
+  }
+
+  type = 0;
+  for (int retry = 0; retry < 3 && type != UPLOAD_DONE; retry++) {
+    send_frame(UPLOAD_CLOSE, (uint16_t)nblocks, nullptr, 0);
+    type = recv_frame(seq, msg, 5000);
+    if (type == UPLOAD_ERROR) {
+      std::fprintf(stderr, "\nframe error: %s\n", msg.c_str());
+      return 1;
+    }
+  }
+  if (type != UPLOAD_DONE) {
+    std::fprintf(stderr, "\nframe did not confirm upload\n");
+    return 1;
+  }
+
+  double s = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                           start)
+                 .count();
+
+  std::fprintf(stderr,
+               "\nuploaded '%s' as '%s': %u bytes in %.2f s, %.0f B/s (%.0f%% "
+               "of line rate), %u blocks resent\n",
+               path, name.c_str(), size, s, size / s,
+               100.0 * size / s / (baud / 10.0), resent);
+
+  close(fd);
+
+  return 0;
+}
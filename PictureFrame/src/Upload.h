@@ -0,0 +1,75 @@
+/**
+ *  @file    Upload.h
+ *  @brief   Picture Frame Serial Upload Protocol
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-22
+ *  @note    BSD-3 licensed
+ *  @details Shared between the firmware and the host-side uploader. Every
+ *           frame starts with a sync byte followed by a little-endian header
+ *           and at most UPLOAD_BLOCK bytes of payload. The CRC-32 covers the
+ *           type, sequence and length fields followed by the payload.
+ *
+ *           host -> frame: OPEN  (seq 0, payload: uint32 size + file name)
+ *           host -> frame: DATA  (seq n, payload: UPLOAD_BLOCK bytes)
+ *           host -> frame: CLOSE (seq n, no payload)
+ *           frame -> host: ACK   (seq of the next expected DATA block)
+ *           frame -> host: NAK   (seq of the next expected DATA block)
+ *           frame -> host: DONE  (seq of the last DATA block + 1)
+ *           frame -> host: ERROR (seq 0, payload: message)
+ *
+ *           The host keeps up to UPLOAD_WINDOW DATA blocks in flight and
+ *           rewinds to the sequence number carried by a NAK (go-back-N).
+ *
+ ***********************************************/
+
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define UPLOAD_SYNC 0xA5
+#define UPLOAD_BLOCK 1024
+#define UPLOAD_WINDOW 8
+#define UPLOAD_CHUNK 4096 // bytes written to flash at once
+#define UPLOAD_TIMEOUT 5000ul // in ms
+#define UPLOAD_NAME_MAX 31    // SPIFFS object name limit
+
+#define UPLOAD_OPEN 'O'
+#define UPLOAD_DATA 'D'
+#define UPLOAD_CLOSE 'C'
+#define UPLOAD_ACK 'A'
+#define UPLOAD_NAK 'N'
+#define UPLOAD_DONE 'F'
+#define UPLOAD_ERROR 'E'
+
+struct __attribute__((packed)) UploadHeader {
+  uint8_t sync;
+  uint8_t type;
+  uint16_t seq;
+  uint16_t len;
+  uint32_t crc;
+};
+
+static inline uint32_t upload_crc32(uint32_t crc, const uint8_t *data,
+                                    size_t len) {
+  static const uint32_t table[16] = {
+      0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4,
+      0x4DB26158, 0x5005713C, 0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+      0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+  crc = ~crc;
+  while (len--) {
+    crc ^= *data++;
+    crc = (crc >> 4) ^ table[crc & 0x0F];
+    crc = (crc >> 4) ^ table[crc & 0x0F];
+  }
+  return ~crc;
+}
+
+static inline uint32_t upload_crc(const struct UploadHeader *hdr,
+                                  const uint8_t *payload) {
+  uint32_t crc = upload_crc32(0, &hdr->type, 5);
+  return upload_crc32(crc, payload, hdr->len);
+}
+
+#endif // UPLOAD_H
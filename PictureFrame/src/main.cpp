@@ -9,18 +9,121 @@
 
 #include <SPIFFS.h>
 #include <TFT_eSPI.h>
+#include <esp_heap_caps.h>
+
+#include <algorithm>
 #include <cstring>
 #include <string>
 #include <vector>
 
+#include "Upload.h"
+
+#define UPLOAD_TMP "/upload.tmp"
+
 TFT_eSPI tft = TFT_eSPI();
 
 std::vector<std::string> images;
 
+#define IMAGE_WIDTH_MAX 320
+#define DMA_ROW_BYTES (3 * IMAGE_WIDTH_MAX + 3)
+#define DMA_POOL_SIZE 2
+
+// allocated once in setup() and reused by every render, keeps the heap intact
+static uint8_t *dma_pool[DMA_POOL_SIZE];
+
+// set once setup() completes; without SPIFFS or the DMA pool there is nothing
+// to upload to or draw with, so loop() stays idle
+static bool ready = false;
+
+bool dma_pool_init() {
+  for (uint8_t i = 0; i < DMA_POOL_SIZE; i++) {
+    dma_pool[i] = (uint8_t *)heap_caps_malloc(DMA_ROW_BYTES, MALLOC_CAP_DMA);
+    if (!dma_pool[i])
+      return false;
+  }
+  return true;
+}
+
+#define PHASE_OPEN 0
+#define PHASE_HEADER 1
+#define PHASE_READ 2
+#define PHASE_CONVERT 3
+#define PHASE_DMA 4
+#define PHASE_TOTAL 5
+#define PHASE_NUMBER 6
+
+#define HISTOGRAM_BINS 24 // log2 buckets in us, the last one is open-ended
+
+struct Histogram {
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t sum;
+  uint32_t bins[HISTOGRAM_BINS];
+};
+
+static struct Histogram render_stats[PHASE_NUMBER];
+
+void histogram_add(struct Histogram &h, uint32_t us) {
+  uint8_t bin = us ? 32 - __builtin_clz(us) : 0;
+  if (bin >= HISTOGRAM_BINS)
+    bin = HISTOGRAM_BINS - 1;
+  ++h.bins[bin];
+  if (h.count == 0 || us < h.min)
+    h.min = us;
+  if (us > h.max)
+    h.max = us;
+  h.sum += us;
+  ++h.count;
+}
+
+void stats_reset() { std::memset(render_stats, 0, sizeof(render_stats)); }
+
+void stats_dump() {
+  const char *phases[PHASE_NUMBER] = {"open",    "header", "read",
+                                      "convert", "dma",    "total"};
+  char buf[96];
+  Serial.println("phase    count   min(us)   avg(us)   max(us)");
+  for (uint8_t i = 0; i < PHASE_NUMBER; i++) {
+    const struct Histogram &h = render_stats[i];
+    snprintf(buf, sizeof(buf), "%-8s %5u %9u %9u %9u", phases[i],
+             (unsigned)h.count, (unsigned)h.min,
+             h.count ? (unsigned)(h.sum / h.count) : 0, (unsigned)h.max);
+    Serial.println(buf);
+  }
+  Serial.println("histogram (us, upper bound)");
+  for (uint8_t i = 0; i < PHASE_NUMBER; i++) {
+    Serial.print(phases[i]);
+    Serial.print(':');
+    for (uint8_t bin = 0; bin < HISTOGRAM_BINS; bin++) {
+      if (render_stats[i].bins[bin] == 0)
+        continue;
+      snprintf(buf, sizeof(buf), " <%lu=%u", 1ul << bin,
+               (unsigned)render_stats[i].bins[bin]);
+      Serial.print(buf);
+    }
+    Serial.println();
+  }
+  snprintf(buf, sizeof(buf), "heap: free %u, min free %u, max block %u",
+           (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT),
+           (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+           (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+  Serial.println(buf);
+  snprintf(buf, sizeof(buf), "dma heap: free %u, min free %u, max block %u",
+           (unsigned)heap_caps_get_free_size(MALLOC_CAP_DMA),
+           (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_DMA),
+           (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_DMA));
+  Serial.println(buf);
+}
+
 int drawbmp(const char *filename) {
 
+  uint32_t t[PHASE_NUMBER] = {0}, us = micros(), start = us;
+
   File file = SPIFFS.open(filename, "r");
 
+  t[PHASE_OPEN] = micros() - us;
+
   if (!file) {
     Serial.print("failed to open '");
     Serial.print(filename);
@@ -34,6 +137,8 @@ int drawbmp(const char *filename) {
   Serial.print(file.size());
   Serial.println(" bytes)");
 
+  us = micros();
+
   unsigned char header[54];
 
   file.readBytes(reinterpret_cast<char *>(&header), sizeof(header));
@@ -43,6 +148,7 @@ int drawbmp(const char *filename) {
 
   if(sig != 0x4d42) {
     Serial.println("not a BMP image");
+    file.close();
     return 0;
   }
 
@@ -59,6 +165,7 @@ int drawbmp(const char *filename) {
 
   if (width * height <= 0) {
     Serial.println("invalid size");
+    file.close();
     return 0;
   }
 
@@ -70,21 +177,32 @@ int drawbmp(const char *filename) {
 
   if(bpp != 24){
     Serial.println("invalid bpp");
+    file.close();
+    return 0;
+  }
+
+  if (width > IMAGE_WIDTH_MAX) {
+    Serial.println("image too wide");
+    file.close();
     return 0;
   }
   
   const uint16_t padding = (4 - ((width * 3) & 3)) & 3,
                  padded = 3 * width + padding;
 
-  unsigned char *dma1 = new unsigned char[padded],
-                *dma2 = new unsigned char[padded], *row = dma1;
+  unsigned char *row = dma_pool[0];
 
-  bool dma = false;
+  uint8_t dma = 0;
 
   unsigned long ms = millis();
 
+  t[PHASE_HEADER] = micros() - us;
+
   for (int16_t y = height - 1; y >= 0; --y) {
+    us = micros();
     file.readBytes((char *)row, padded);
+    t[PHASE_READ] += micros() - us;
+    us = micros();
     uint8_t *bit888 = row;
     uint16_t *color565 = (uint16_t *)row;
     for (uint16_t x = 0; x < width; x++) {
@@ -93,25 +211,284 @@ int drawbmp(const char *filename) {
       uint8_t b = *bit888++;
       *color565++ = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
     }
-    tft.pushImageDMA(0, y, width, 1, (uint16_t *)row);
-    row = dma ? dma1 : dma2;
-    dma = !dma;
+    t[PHASE_CONVERT] += micros() - us;
+    us = micros();
+    tft.pushImageDMA(0, y, width, 1, (uint16_t *)row); // waits for previous
+    t[PHASE_DMA] += micros() - us;
+    dma = (dma + 1) % DMA_POOL_SIZE;
+    row = dma_pool[dma];
   }
+  us = micros();
   tft.dmaWait();
+  t[PHASE_DMA] += micros() - us;
 
   Serial.print("rendered in ");
   Serial.print(millis() - ms);
   Serial.println(" ms");
 
-  delete[] dma1;
-  delete[] dma2;
-
   file.close();
 
+  t[PHASE_TOTAL] = micros() - start;
+  for (uint8_t i = 0; i < PHASE_NUMBER; i++)
+    histogram_add(render_stats[i], t[i]);
+
   return 1;
 }
 
+struct {
+  File file;
+  char name[UPLOAD_NAME_MAX + 1];
+  uint32_t size;
+  uint32_t received;
+  uint16_t seq;
+  uint16_t fill;
+  bool active;
+  bool done;
+  bool nak;
+  unsigned long timer;
+  unsigned long ms;
+  struct UploadHeader hdr;
+  uint8_t hdr_len;
+  uint16_t payload_len;
+  uint8_t *payload;
+} upload;
+
+// DATA payloads are received in place, straight behind the pending flash data
+alignas(4) static uint8_t upload_chunk[UPLOAD_CHUNK + UPLOAD_BLOCK];
+static uint8_t upload_ctrl[UPLOAD_BLOCK];
+
+void upload_reply(uint8_t type, uint16_t seq, const char *msg = nullptr) {
+  struct UploadHeader hdr = {.sync = UPLOAD_SYNC,
+                             .type = type,
+                             .seq = seq,
+                             .len = (uint16_t)(msg ? strlen(msg) : 0),
+                             .crc = 0};
+  hdr.crc = upload_crc(&hdr, (const uint8_t *)msg);
+  Serial.write((const uint8_t *)&hdr, sizeof(hdr));
+  if (hdr.len)
+    Serial.write((const uint8_t *)msg, hdr.len);
+}
+
+void upload_abort(const char *msg) {
+  upload_reply(UPLOAD_ERROR, upload.seq, msg);
+  if (upload.active) {
+    upload.file.close();
+    SPIFFS.remove(UPLOAD_TMP);
+    upload.active = false;
+  }
+}
+
+void upload_open(const uint8_t *payload, uint16_t len) {
+  if (upload.active) {
+    upload.file.close();
+    upload.active = false;
+  }
+
+  uint16_t name_len = len - sizeof(upload.size);
+  if (len <= sizeof(upload.size) || name_len > UPLOAD_NAME_MAX ||
+      payload[sizeof(upload.size)] != '/') {
+    upload_abort("invalid name");
+    return;
+  }
+
+  std::memcpy(&upload.size, payload, sizeof(upload.size));
+  std::memcpy(upload.name, payload + sizeof(upload.size), name_len);
+  upload.name[name_len] = '\0';
+
+  if (upload.size > SPIFFS.totalBytes() - SPIFFS.usedBytes()) {
+    upload_abort("not enough space");
+    return;
+  }
+
+  upload.file = SPIFFS.open(UPLOAD_TMP, "w");
+  if (!upload.file) {
+    upload_abort("failed to open");
+    return;
+  }
+
+  upload.received = 0;
+  upload.seq = 0;
+  upload.fill = 0;
+  upload.nak = false;
+  upload.done = false;
+  upload.active = true;
+  upload.ms = millis();
+
+  upload_reply(UPLOAD_ACK, upload.seq);
+}
+
+void upload_nak() {
+  if (upload.nak)
+    return;
+  upload_reply(UPLOAD_NAK, upload.seq);
+  upload.nak = true;
+}
+
+void upload_data(uint16_t seq, uint16_t len) {
+  if (seq != upload.seq) {
+    upload_nak();
+    return;
+  }
+
+  if (upload.received + len > upload.size) {
+    upload_abort("size exceeded");
+    return;
+  }
+
+  upload.fill += len;
+  upload.received += len;
+  ++upload.seq;
+  upload.nak = false;
+
+  if (upload.fill >= UPLOAD_CHUNK) {
+    if (upload.file.write(upload_chunk, UPLOAD_CHUNK) != UPLOAD_CHUNK) {
+      upload_abort("write failed");
+      return;
+    }
+    upload.fill -= UPLOAD_CHUNK;
+    std::memmove(upload_chunk, upload_chunk + UPLOAD_CHUNK, upload.fill);
+  }
+
+  upload_reply(UPLOAD_ACK, upload.seq);
+}
+
+void upload_close(uint16_t seq) {
+  if (seq != upload.seq) {
+    upload_nak();
+    return;
+  }
+
+  if (upload.received != upload.size) {
+    upload_abort("size mismatch");
+    return;
+  }
+
+  if (upload.fill &&
+      upload.file.write(upload_chunk, upload.fill) != upload.fill) {
+    upload_abort("write failed");
+    return;
+  }
+  upload.file.close();
+  upload.active = false;
+
+  if (SPIFFS.exists(upload.name))
+    SPIFFS.remove(upload.name);
+
+  if (!SPIFFS.rename(UPLOAD_TMP, upload.name)) {
+    SPIFFS.remove(UPLOAD_TMP);
+    upload_reply(UPLOAD_ERROR, upload.seq, "rename failed");
+    return;
+  }
+
+  upload.done = true;
+  upload_reply(UPLOAD_DONE, upload.seq);
+
+  if (std::find(images.begin(), images.end(), upload.name) == images.end())
+    images.emplace_back(upload.name);
+
+  Serial.print("uploaded '");
+  Serial.print(upload.name);
+  Serial.print("' (");
+  Serial.print(upload.size);
+  Serial.print(" bytes in ");
+  Serial.print(millis() - upload.ms);
+  Serial.println(" ms)");
+}
+
+void upload_frame() {
+  if (upload_crc(&upload.hdr, upload.payload) != upload.hdr.crc) {
+    if (upload.active)
+      upload_nak();
+    return;
+  }
+
+  upload.timer = millis();
+
+  switch (upload.hdr.type) {
+  case UPLOAD_OPEN:
+    upload_open(upload.payload, upload.hdr.len);
+    break;
+  case UPLOAD_DATA:
+    if (upload.active)
+      upload_data(upload.hdr.seq, upload.hdr.len);
+    else
+      upload_reply(UPLOAD_ERROR, upload.hdr.seq, "no upload");
+    break;
+  case UPLOAD_CLOSE:
+    if (upload.active)
+      upload_close(upload.hdr.seq);
+    else if (upload.done && upload.hdr.seq == upload.seq)
+      upload_reply(UPLOAD_DONE, upload.seq); // our DONE got lost
+    else
+      upload_reply(UPLOAD_ERROR, upload.hdr.seq, "no upload");
+  }
+}
+
+void command(char c) {
+  static char cmd[16];
+  static uint8_t len = 0;
+
+  if (c != '\n' && c != '\r') {
+    if (len < sizeof(cmd) - 1)
+      cmd[len++] = c;
+    return;
+  }
+
+  cmd[len] = '\0';
+  len = 0;
+
+  if (std::strcmp(cmd, "stats") == 0)
+    stats_dump();
+  else if (std::strcmp(cmd, "reset") == 0)
+    stats_reset();
+}
+
+void upload_loop() {
+  int available;
+  while ((available = Serial.available()) > 0) {
+    if (upload.hdr_len == 0) {
+      int c = Serial.read();
+      if (c == UPLOAD_SYNC) {
+        upload.hdr.sync = UPLOAD_SYNC;
+        upload.hdr_len = 1;
+      } else if (!upload.active)
+        command(c);
+      continue;
+    }
+
+    if (upload.hdr_len < sizeof(upload.hdr)) {
+      upload.hdr_len += Serial.readBytes(
+          (uint8_t *)&upload.hdr + upload.hdr_len,
+          _min((size_t)available, sizeof(upload.hdr) - upload.hdr_len));
+      if (upload.hdr_len < sizeof(upload.hdr))
+        continue;
+      if (upload.hdr.len > UPLOAD_BLOCK) {
+        upload.hdr_len = 0; // not a frame, hunt for the next sync
+        continue;
+      }
+      upload.payload = upload.hdr.type == UPLOAD_DATA && upload.active
+                           ? upload_chunk + upload.fill
+                           : upload_ctrl;
+      upload.payload_len = 0;
+    } else
+      upload.payload_len += Serial.readBytes(
+          upload.payload + upload.payload_len,
+          _min((uint16_t)available,
+               (uint16_t)(upload.hdr.len - upload.payload_len)));
+
+    if (upload.payload_len == upload.hdr.len) {
+      upload_frame();
+      upload.hdr_len = 0;
+    }
+  }
+
+  if (upload.active && (millis() - upload.timer) > UPLOAD_TIMEOUT)
+    upload_abort("timed out");
+}
+
 void setup(void) {
+  Serial.setRxBufferSize(2 * UPLOAD_WINDOW *
+                         (sizeof(struct UploadHeader) + UPLOAD_BLOCK));
   Serial.begin(115200);
   if (!SPIFFS.begin(true)) {
     Serial.println("failed to mount SPIFFS");
@@ -127,10 +504,21 @@ void setup(void) {
   tft.fillScreen(TFT_BLACK);
   tft.initDMA(true);
 
+  if (!dma_pool_init()) {
+    Serial.println("failed to allocate DMA buffers");
+    return;
+  }
+
   File root = SPIFFS.open("/", "r");
   File file;
-  while (file = root.openNextFile("r"))
+  while (file = root.openNextFile("r")) {
+    if (std::strcmp(file.name(), UPLOAD_TMP) == 0) {
+      file.close();
+      SPIFFS.remove(UPLOAD_TMP); // left over from an interrupted upload
+      continue;
+    }
     images.emplace_back(file.name());
+  }
 
   if (!images.empty()) {
     while (!drawbmp(images[rand() % images.size()].c_str())) {
@@ -139,12 +527,22 @@ void setup(void) {
 
   pinMode(LED_BUILTIN, OUTPUT);
   digitalWrite(LED_BUILTIN, LOW);
+
+  ready = true;
 }
 
 void loop() {
 
   static unsigned long timer = millis();
 
+  if (!ready)
+    return;
+
+  upload_loop();
+
+  if (upload.active || images.empty())
+    return;
+
   unsigned long ms = millis();
   if (ms - timer >= 10000ul) {
     if (drawbmp(images[rand() % images.size()].c_str())) {
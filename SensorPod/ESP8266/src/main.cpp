@@ -17,6 +17,8 @@
 
 #include <time.h>
 
+#include "../../common/Protocol.h"
+
 uint16_t wifi_status = 425;
 unsigned long wifi_timeout;
 
@@ -62,6 +64,7 @@ void setup() {
   settimeofday_cb(NTPCallback);
   configTime(TZ_America_Los_Angeles, "pool.ntp.org");
 
+  Serial.setRxBufferSize(512); // holds the frames that arrive while relaying
   Serial.begin(19200);
   Serial.println();
 
@@ -105,13 +108,62 @@ void setup() {
   log(Serial, F("Configured NTP with timezone America/Los_Angeles"));
 }
 
-void relayURL() {
+struct {
+  uint8_t seq;
+  uint8_t length;
+  uint8_t payload[PROTOCOL_RESPONSE_MAX];
+} response;
+
+void respond_flush() {
+
+  if (response.length > 0)
+    protocol_write(Serial, response.seq, response.payload, response.length);
+
+  response.length = 0;
+}
+
+void respond(uint8_t type, const void *body, uint8_t len) {
 
-  String host = Serial.readStringUntil('\n');
+  struct ProtocolMessage msg = {.type = type, .length = len};
 
-  if (host.length() == 0) {
+  if (response.length + sizeof(msg) + len > sizeof(response.payload))
+    respond_flush();
+
+  memcpy(response.payload + response.length, &msg, sizeof(msg));
+  memcpy(response.payload + response.length + sizeof(msg), body, len);
+  response.length += sizeof(msg) + len;
+}
+
+bool awaitURLAck() {
+
+  uint8_t payload[sizeof(struct ProtocolMessage)];
+  struct ProtocolReader reader = {.payload = payload, .size = sizeof(payload)};
+
+  unsigned long timeout = millis();
+
+  while ((millis() - timeout) < 5000ul) {
+    yield();
+    if (!Serial.available())
+      continue;
+    switch (protocol_read(&reader, Serial.read())) {
+    case PROTOCOL_FRAME:
+      return reader.hdr.length == sizeof(payload) &&
+             payload[0] == PROTOCOL_URL && payload[1] == 0;
+    case PROTOCOL_ERROR:
+      return false;
+    }
+  }
+
+  return false;
+}
+
+void relayURL(const char *host) {
+
+  struct StatusResponse url = {.error = 400};
+
+  if (strlen(host) == 0) {
     log(Serial, F("Invalid host"));
-    Serial.write(0x04);
+    respond(PROTOCOL_URL, &url, sizeof(url));
     return;
   }
 
@@ -119,62 +171,49 @@ void relayURL() {
 
   if (!client.connect(host, 80)) {
     log(Serial, F("Connection failed"));
-    Serial.write(0x04);
+    url.error = 502;
+    respond(PROTOCOL_URL, &url, sizeof(url));
     return;
   }
 
   client.print(F("GET /index.php HTTP/1.0\r\nConnection: close\r\n\r\n"));
 
-  uint8_t pck_len = 56;
+  uint8_t chunk[sizeof(url) + PROTOCOL_URL_CHUNK];
 
   unsigned long timeout = millis();
 
-  while (client.connected() || client.available()) {
+  for (;;) {
     yield();
     int available = client.available();
-    if (!client.connected() && available < pck_len)
-      pck_len = available;
-    if (available >= pck_len) {
-      for (uint8_t i = 0; i < pck_len; i++)
-        Serial.write(client.read());
-      if (pck_len < 56)
+    bool last = !client.connected() && available <= PROTOCOL_URL_CHUNK;
+    if (last || available >= PROTOCOL_URL_CHUNK) {
+      url.error = last ? 200 : 206;
+      memcpy(chunk, &url, sizeof(url));
+      int n = client.read(chunk + sizeof(url),
+                          last ? available : PROTOCOL_URL_CHUNK);
+      respond(PROTOCOL_URL, chunk, sizeof(url) + n);
+      respond_flush();
+      if (last)
         break;
-      while (!Serial.available()) {
-        yield();
-        if ((millis() - timeout) >= 5000ul) {
-          log(Serial, F("ACK timed out"));
-          Serial.write(0x04);
-          client.stop();
-          return;
-        }
-      }
-      if (Serial.read() != 0x06) {
-        log(Serial, F("Invalid response"));
+      if (!awaitURLAck()) {
+        log(Serial, F("ACK missing"));
         break;
       }
+      timeout = millis();
     } else if ((millis() - timeout) >= 5000ul) {
       log(Serial, F("Request timed out"));
+      url.error = 408;
+      respond(PROTOCOL_URL, &url, sizeof(url));
       break;
     }
   }
 
-  Serial.write(0x04);
-
   client.stop();
 }
 
 void relayNTPBasedTime() {
 
-  struct NTPResponse {
-    uint8_t year;
-    uint8_t month;
-    uint8_t weekday;
-    uint8_t day;
-    uint8_t hour;
-    uint8_t minute;
-    uint8_t second;
-    uint8_t error;
-  } ntp;
+  struct NTPResponse ntp = {0};
 
   if (NTPTimeValid) {
     time_t epoch = time(NULL);
@@ -190,7 +229,7 @@ void relayNTPBasedTime() {
   } else
     ntp.error = 202;
 
-  Serial.write((char *)&ntp, sizeof(struct NTPResponse));
+  respond(PROTOCOL_NTP, &ntp, sizeof(ntp));
 }
 
 uint16_t getJSON(WiFiClient &client, const char *host, const char *path) {
@@ -246,11 +285,7 @@ uint16_t getJSON(WiFiClient &client, const char *host, const char *path) {
 
 void relayUVIdx() {
 
-  struct UVIResponse {
-    uint16_t error;
-    uint8_t uv;
-    uint8_t padding;
-  } uvi;
+  struct UVIResponse uvi = {0};
 
   WiFiClientSecure client;
 
@@ -261,7 +296,7 @@ void relayUVIdx() {
 
   uvi.error = getJSON(client, host, path);
   if (uvi.error != 200) {
-    Serial.write((char *)&uvi, sizeof(struct UVIResponse));
+    respond(PROTOCOL_UVI, &uvi, sizeof(uvi));
     client.stop();
     return;
   }
@@ -283,14 +318,14 @@ void relayUVIdx() {
 
   if (error) {
     uvi.error = 10;
-    Serial.write((char *)&uvi, sizeof(struct UVIResponse));
+    respond(PROTOCOL_UVI, &uvi, sizeof(uvi));
     client.stop();
     return;
   }
 
   if (!doc[0][FPSTR(key)]) {
     uvi.error = 11;
-    Serial.write((char *)&uvi, sizeof(struct UVIResponse));
+    respond(PROTOCOL_UVI, &uvi, sizeof(uvi));
     client.stop();
     return;
   }
@@ -299,21 +334,12 @@ void relayUVIdx() {
 
   client.stop();
 
-  Serial.write((char *)&uvi, sizeof(struct UVIResponse));
+  respond(PROTOCOL_UVI, &uvi, sizeof(uvi));
 }
 
 void relayWeatherFC() {
 
-  struct WFCResponse {
-    float temperature;
-    float dewpoint;
-    float windDirection;
-    float windSpeed;
-    float windGust;
-    float relativeHumidity;
-    uint16_t error;
-    uint8_t padding[2];
-  } wfc;
+  struct WFCResponse wfc = {0};
 
   WiFiClientSecure client;
 
@@ -326,7 +352,7 @@ void relayWeatherFC() {
 
   wfc.error = getJSON(client, host, path);
   if (wfc.error != 200) {
-    Serial.write((char *)&wfc, sizeof(struct WFCResponse));
+    respond(PROTOCOL_WFC, &wfc, sizeof(wfc));
     client.stop();
     return;
   }
@@ -353,7 +379,7 @@ void relayWeatherFC() {
 
   if (error) {
     wfc.error = 7;
-    Serial.write((char *)&wfc, sizeof(struct WFCResponse));
+    respond(PROTOCOL_WFC, &wfc, sizeof(wfc));
     client.stop();
     return;
   }
@@ -388,24 +414,28 @@ void relayWeatherFC() {
 
   client.stop();
 
-  Serial.write((char *)&wfc, sizeof(struct WFCResponse));
+  respond(PROTOCOL_WFC, &wfc, sizeof(wfc));
 }
 
-void postJSONMsg() {
+void postJSONMsg(char *host) {
+
+  struct StatusResponse pst = {.error = 400};
 
-  String host = Serial.readStringUntil('\n'),
-         path = Serial.readStringUntil('\n'),
-         json = Serial.readStringUntil('\n');
+  char *path = strchr(host, '\n'), *json = path ? strchr(path + 1, '\n') : NULL;
 
-  if (host.length() == 0 || path.length() == 0 || json.length() == 0) {
-    Serial.print(400);
+  if (path == NULL || json == NULL || path == host || json == path + 1 ||
+      json[1] == '\0') {
+    respond(PROTOCOL_PST, &pst, sizeof(pst));
     return;
   }
 
+  *path++ = '\0';
+  *json++ = '\0';
+
   WiFiClient client;
 
   if (!client.connect(host, 80)) {
-    Serial.print(400);
+    respond(PROTOCOL_PST, &pst, sizeof(pst));
     return;
   }
 
@@ -413,12 +443,13 @@ void postJSONMsg() {
                        "(christiaanboersma@hotmail.com)\r\nConnection: "
                        "close\r\nAccept: application/json\r\nContent-Type: "
                        "application/json\r\nContent-Length: %d\r\n\r\n%s"),
-                  path.c_str(), host.c_str(), json.length(), json.c_str());
+                  path, host, strlen(json), json);
 
   unsigned long timeout = millis();
   while (client.available() == 0) {
     if ((millis() - timeout) >= 10000ul) {
-      Serial.print(504);
+      pst.error = 504;
+      respond(PROTOCOL_PST, &pst, sizeof(pst));
       return;
     }
   }
@@ -427,7 +458,58 @@ void postJSONMsg() {
 
   client.readBytesUntil('\r', status, sizeof(status));
 
-  Serial.print(atoi(status + 9));
+  pst.error = atoi(status + 9);
+  respond(PROTOCOL_PST, &pst, sizeof(pst));
+}
+
+void relayFrame(uint8_t seq, uint8_t *payload, uint8_t len) {
+
+  response.seq = seq;
+
+  struct ProtocolMessage *msg;
+  for (uint8_t pos = 0; (msg = protocol_message(payload, len, pos));
+       pos += sizeof(struct ProtocolMessage) + msg->length) {
+
+    char body[PROTOCOL_REQUEST_MAX + 1];
+    memcpy(body, msg + 1, msg->length);
+    body[msg->length] = '\0';
+
+    // send what is ready before fetching, so quick answers are not held up
+    bool fetch = msg->type != PROTOCOL_NTP && msg->type != PROTOCOL_WIF;
+    if (fetch)
+      respond_flush();
+
+    switch (msg->type) {
+    case PROTOCOL_NTP:
+      relayNTPBasedTime();
+      break;
+    case PROTOCOL_WIF: {
+      struct StatusResponse wif = {.error = wifi_status};
+      respond(PROTOCOL_WIF, &wif, sizeof(wif));
+    } break;
+    case PROTOCOL_WFC:
+      relayWeatherFC();
+      break;
+    case PROTOCOL_UVI:
+      relayUVIdx();
+      break;
+    case PROTOCOL_PST:
+      postJSONMsg(body);
+      break;
+    case PROTOCOL_URL:
+      relayURL(body);
+      break;
+    default: {
+      struct StatusResponse none = {.error = 501};
+      respond(msg->type, &none, sizeof(none));
+    }
+    }
+
+    if (fetch)
+      respond_flush();
+  }
+
+  respond_flush();
 }
 
 void loop() {
@@ -437,23 +519,17 @@ void loop() {
     ESP.restart();
   }
 
-  if (Serial.available()) {
-    String command = Serial.readStringUntil('\n');
-    if (command.length() > 0) {
-      if (command == F("WFC"))
-        relayWeatherFC();
-      else if (command == F("PST"))
-        postJSONMsg();
-      else if (command == F("UVI"))
-        relayUVIdx();
-      else if (command == F("NTP"))
-        relayNTPBasedTime();
-      else if (command == F("URL"))
-        relayURL();
-      else if (command == F("WIF"))
-        Serial.write((uint8_t *)&wifi_status, sizeof(wifi_status));
-      else if (command == F("RSP"))
-        Serial.write(0x06);
+  static uint8_t payload[PROTOCOL_REQUEST_MAX];
+  static struct ProtocolReader reader = {.payload = payload,
+                                         .size = sizeof(payload)};
+
+  while (Serial.available()) {
+    switch (protocol_read(&reader, Serial.read())) {
+    case PROTOCOL_FRAME:
+      relayFrame(reader.hdr.seq, payload, reader.hdr.length);
+      break;
+    case PROTOCOL_ERROR:
+      log(Serial, F("Dropped frame %d"), reader.hdr.seq);
     }
   }
 }
@@ -11,6 +11,8 @@
 #include <U8x8lib.h>
 #include <Wire.h>
 
+#include "../../common/Protocol.h"
+
 #define POST_SERVER_ADDRESS "SERVER ADDRESS/NAME"
 
 #define DSM501PM1_0_PIN 2
@@ -21,9 +23,9 @@
 #define DSM501NPMS 2
 
 #define DSM501WINDOW 3600000ul // 1 hour in ms
+#define DSM501SAMPLE 30000ul   // 30 s in ms, per ratio
 
-void post_handler();
-void updateUVI_handler();
+void queue_handler(uint8_t type, uint8_t stage, struct ProtocolMessage *msg);
 
 int log(Stream &str, const __FlashStringHelper *restrict_format, ...);
 struct DSM501 {
@@ -41,6 +43,39 @@ struct DSM501 {
 #define DSM501_WARMUP 0
 #define DSM501_MEASURE 1
 
+// Low pulses are timed on the outputs' interrupts, pins 2 and 3 being INT0
+// and INT1, and summed until dsm_take() collects them.
+static volatile unsigned long dsm_low[DSM501NPMS];  // in us
+static volatile unsigned long dsm_fall[DSM501NPMS]; // in us
+static volatile bool dsm_is_low[DSM501NPMS];
+
+static inline void dsm_edge(uint8_t i) {
+  const unsigned long us = micros();
+  const bool low = digitalRead(dsm501.pm[i].pin) == LOW;
+  if (low)
+    dsm_fall[i] = us;
+  else if (dsm_is_low[i])
+    dsm_low[i] += us - dsm_fall[i];
+  dsm_is_low[i] = low;
+}
+
+void dsm_pm1_0_isr() { dsm_edge(DSM501PM1_0); }
+void dsm_pm2_5_isr() { dsm_edge(DSM501PM2_5); }
+
+// the time spent low since the last call, including a pulse in progress
+unsigned long dsm_take(uint8_t i) {
+  noInterrupts();
+  const unsigned long us = micros();
+  unsigned long low = dsm_low[i];
+  if (dsm_is_low[i]) {
+    low += us - dsm_fall[i];
+    dsm_fall[i] = us;
+  }
+  dsm_low[i] = 0ul;
+  interrupts();
+  return low; // in us
+}
+
 void dsm_start() {
 
   pinMode(DSM501PM1_0_PIN, INPUT);
@@ -51,16 +86,27 @@ void dsm_start() {
 
   dsm501.state = DSM501_MEASURE;
 
-  for (uint8_t i = 0; i < DSM501NPMS; i++)
+  for (uint8_t i = 0; i < DSM501NPMS; i++) {
     dsm501.pm[i].t0 = millis(); // in ms
+    dsm_is_low[i] = digitalRead(dsm501.pm[i].pin) == LOW;
+    dsm_fall[i] = micros();
+  }
+
+  attachInterrupt(digitalPinToInterrupt(DSM501PM1_0_PIN), dsm_pm1_0_isr,
+                  CHANGE);
+  attachInterrupt(digitalPinToInterrupt(DSM501PM2_5_PIN), dsm_pm2_5_isr,
+                  CHANGE);
 }
 
 void dsm_loop() {
   static float pm[DSM501NPMS] = {0.0f};
   switch (dsm501.state) {
   case DSM501_MEASURE: {
+    if ((millis() - dsm501.pm[DSM501PM1_0].t0) < DSM501SAMPLE)
+      break;
+
     for (uint8_t i = 0; i < DSM501NPMS; i++) {
-      unsigned long pulse = pulseIn(dsm501.pm[i].pin, LOW, 240000ul),
+      unsigned long pulse = dsm_take(i), // in us
                     ms = millis(),
                     dt = ms - dsm501.pm[i].t0; // in ms
 
@@ -200,6 +246,8 @@ void wifi_loop() {
 uint16_t uv_error = 503, post_error = 503, wfc_error = 503, wifi_error = 503,
          ntp_error = 503;
 
+unsigned long queue_wait = 0ul; // average, in ms
+
 struct WeatherFC {
   float temperature;
   float dewpoint;
@@ -331,12 +379,13 @@ void toggle_screen() {
 // 1kOhm resistor in voltage divider
 #define KLS6_PIN 0
 
+#define LUX_TABLE_STEP 4 // 1kB of flash, within 4% below 100k lux
+#include "../../../LuxMeter/src/LuxTable.h"
+
 void kls_read(char *lux_str) {
   static float lux = 0.0f;
-  float Vout = (float)analogRead(KLS6_PIN),
-        Rphoto = 1.0 * (1023.0 - Vout) / Vout,
-        value = pow(10.0, (3.2784 - log10(Rphoto) * 1.63675));
-  dtostrf(0.9f * lux + 0.1f * value, 5, 1, lux_str);
+  lux = 0.9f * lux + 0.1f * lux_lookup(analogRead(KLS6_PIN));
+  dtostrf(lux, 5, 1, lux_str);
 }
 
 void screen_draw_datetime() {
@@ -470,6 +519,9 @@ void screen_draw_status() {
              DateTime.minute, DateTime.second);
   u8x8.drawString(8, 0, buf);
 
+  snprintf_P(buf, sizeof(buf), PSTR("wait:%6lums"), min(queue_wait, 999999ul));
+  u8x8.drawString(3, 1, buf);
+
   snprintf_P(buf, sizeof(buf), PSTR("WiFi   : %3d"), wifi_error);
   u8x8.drawString(0, 2, buf);
 
@@ -490,75 +542,224 @@ void screen_draw_status() {
   u8x8.drawString(0, 7, buf);
 }
 
-void default_handler() {
+#define QUEUE_EXEC 0
+#define QUEUE_ACT 1
+#define QUEUE_FAILED 2
+#define QUEUE_TIMEOUT 3
+
+// per PROTOCOL_ type; lower priorities go first, and as the ESP8266 works
+// through requests one at a time, a timeout runs from when it gets to one
+const struct {
+  uint8_t priority;
+  uint16_t timeout; // in ms
+} queue_requests[PROTOCOL_TYPES] = {
+    {0, 0u},     // unused
+    {0, 3000u},  // NTP, answered at once
+    {1, 3000u},  // WIF, answered at once
+    {4, 15000u}, // WFC
+    {3, 15000u}, // UVI
+    {2, 15000u}, // PST
+    {5, 5000u}   // URL, per part
+};
 
-  while (ESP8266.available())
-    Serial.write(ESP8266.read());
-}
+#define QUEUE_SLOTS (PROTOCOL_TYPES - 1)
 
-#define QUEUE_IDLE 0
-#define QUEUE_START 1
-#define QUEUE_EXEC 2
-#define QUEUE_ACT 3
-#define QUEUE_FAILED 4
-#define QUEUE_TIMEOUT 5
+#define QUEUE_FREE 0
+#define QUEUE_PENDING 1  // to be sent
+#define QUEUE_WAITING 2  // sent, awaiting its response
+#define QUEUE_ANSWERED 3 // its response is being handled
 
-struct HandlerQueue {
-  uint8_t stage;
-  unsigned long timeout;
-  unsigned long timer;
-  void (*handler)();
+struct QueueSlot {
+  uint8_t type;
+  uint8_t state;
+  uint8_t seq;          // of the frame it went out in
+  uint8_t order;        // in which the ESP8266 gets to it
+  unsigned long queued; // in ms
+  unsigned long timer;  // in ms, since the ESP8266 got to it
 };
 
-struct HandlerQueue queue = {
-    .stage = 0, .timeout = 10000ul, .timer = 0ul, .handler = default_handler};
+struct HandlerQueue {
+  struct QueueSlot slot[QUEUE_SLOTS];
+  uint8_t seq;  // of the last frame sent
+  uint8_t next; // order of the next request sent
+  uint8_t head; // order of the request the ESP8266 is working on
+} queue = {0};
 
-void queue_start(void (*handler)()) {
+uint8_t response[PROTOCOL_RESPONSE_MAX];
+struct ProtocolReader reader = {.payload = response, .size = sizeof(response)};
 
-  queue.handler = handler;
-  ESP8266.print(F("RSP\n"));
-  queue.timer = millis();
-  queue.stage = QUEUE_EXEC;
+struct QueueSlot *queue_find(uint8_t type) {
+
+  for (uint8_t i = 0; i < QUEUE_SLOTS; i++)
+    if (queue.slot[i].state != QUEUE_FREE && queue.slot[i].type == type)
+      return queue.slot + i;
+
+  return NULL;
 }
 
-void queue_reset() {
+bool queue_start(uint8_t type) {
+
+  if (queue_find(type) != NULL)
+    return false;
 
-  queue.handler = default_handler;
-  queue.stage = QUEUE_IDLE;
+  for (uint8_t i = 0; i < QUEUE_SLOTS; i++) {
+    struct QueueSlot *s = queue.slot + i;
+    if (s->state == QUEUE_FREE) {
+      s->type = type;
+      s->state = QUEUE_PENDING;
+      s->queued = millis();
+      return true;
+    }
+  }
+
+  return false;
 }
 
-void queue_execute(const __FlashStringHelper *cmd) {
+// starts the clock of the request the ESP8266 gets to next
+void queue_advance(uint8_t order) {
+
+  queue.head = order;
 
-  if (ESP8266.read() != 0x06) {
-    queue.stage = QUEUE_FAILED;
-    queue.handler();
-    queue_reset();
+  for (uint8_t i = 0; i < QUEUE_SLOTS; i++) {
+    struct QueueSlot *s = queue.slot + i;
+    if (s->state == QUEUE_WAITING && s->order == order) {
+      s->timer = millis();
+      queue_wait = (7 * queue_wait + s->timer - s->queued) / 8;
+    }
+  }
+}
+
+// fails the requests ahead of order, as their responses were lost
+void queue_skip(uint8_t order) {
+
+  for (uint8_t i = 0; i < QUEUE_SLOTS; i++) {
+    struct QueueSlot *s = queue.slot + i;
+    if (s->state == QUEUE_WAITING &&
+        (uint8_t)(s->order - queue.head) < (uint8_t)(order - queue.head)) {
+      s->state = QUEUE_FREE;
+      queue_handler(s->type, QUEUE_FAILED, NULL);
+    }
+  }
+}
+
+void queue_send() {
+
+  // during a page transfer the ESP8266 expects nothing but its acks
+  struct QueueSlot *url = queue_find(PROTOCOL_URL);
+  if (url != NULL && url->state == QUEUE_WAITING)
     return;
+
+  uint8_t payload[PROTOCOL_REQUEST_MAX], len = 0, tried = 0;
+
+  while (len + sizeof(struct ProtocolMessage) < sizeof(payload)) {
+    struct QueueSlot *s = NULL;
+    for (uint8_t i = 0; i < QUEUE_SLOTS; i++) {
+      struct QueueSlot *t = queue.slot + i;
+      if (t->state != QUEUE_PENDING || (tried & bit(i)))
+        continue;
+      if (s == NULL ||
+          queue_requests[t->type].priority <
+              queue_requests[s->type].priority ||
+          (queue_requests[t->type].priority ==
+               queue_requests[s->type].priority &&
+           (long)(t->queued - s->queued) < 0))
+        s = t;
+    }
+    if (s == NULL)
+      break;
+    tried |= bit(s - queue.slot);
+    struct ProtocolMessage *msg = (struct ProtocolMessage *)(payload + len);
+    uint8_t room = sizeof(payload) - len - sizeof(struct ProtocolMessage);
+    msg->type = s->type;
+    msg->length = room;
+    queue_handler(s->type, QUEUE_EXEC, msg);
+    if (msg->length >= room) { // left for the next frame, unless it is empty
+      if (len == 0) {
+        s->state = QUEUE_FREE;
+        queue_handler(s->type, QUEUE_FAILED, msg);
+      }
+      continue;
+    }
+    len += sizeof(struct ProtocolMessage) + msg->length;
+    s->state = QUEUE_WAITING;
+    s->seq = queue.seq + 1;
+    s->order = queue.next++;
+    if (s->order == queue.head) // nothing ahead of it
+      queue_advance(s->order);
   }
-  ESP8266.print(cmd);
-  queue.stage = QUEUE_ACT;
+
+  if (len == 0)
+    return;
+
+  protocol_write(ESP8266, ++queue.seq, payload, len);
 }
 
-void queue_execute(const char *cmd) {
+// asks for the rest of a response that comes in parts
+void queue_continue(uint8_t type) {
 
-  if (ESP8266.read() != 0x06) {
-    queue.stage = QUEUE_FAILED;
-    queue.handler();
-    queue_reset();
+  struct QueueSlot *s = queue_find(type);
+  if (s == NULL || s->state != QUEUE_ANSWERED)
     return;
+
+  uint8_t payload[sizeof(struct ProtocolMessage)] = {type, 0};
+
+  protocol_write(ESP8266, s->seq, payload, sizeof(payload));
+  s->state = QUEUE_WAITING;
+  s->timer = millis();
+}
+
+void queue_dispatch() {
+
+  struct ProtocolMessage *msg;
+  for (uint8_t pos = 0;
+       (msg = protocol_message(response, reader.hdr.length, pos));
+       pos += sizeof(struct ProtocolMessage) + msg->length) {
+    struct QueueSlot *s = queue_find(msg->type);
+    if (s == NULL || s->state != QUEUE_WAITING || s->seq != reader.hdr.seq) {
+      log(Serial, F("Stale response %d/%d"), reader.hdr.seq, msg->type);
+      continue;
+    }
+    queue_skip(s->order);
+    s->state = QUEUE_ANSWERED;
+    queue_handler(s->type, QUEUE_ACT, msg);
+    if (s->state == QUEUE_ANSWERED) {
+      s->state = QUEUE_FREE;
+      queue_advance(s->order + 1);
+    }
+  }
+}
+
+void queue_read() {
+
+  while (ESP8266.available()) {
+    uint8_t c = ESP8266.read();
+    switch (protocol_read(&reader, c)) {
+    case PROTOCOL_OTHER: // the ESP8266's log
+      Serial.write(c);
+      break;
+    case PROTOCOL_FRAME:
+      queue_dispatch();
+      break;
+    case PROTOCOL_ERROR:
+      log(Serial, F("Dropped frame %d"), reader.hdr.seq);
+    }
   }
-  ESP8266.print(cmd);
-  queue.stage = QUEUE_ACT;
 }
 
 void queue_loop() {
 
-  if (queue.handler != default_handler &&
-      (millis() - queue.timer) >= queue.timeout) {
-    queue.stage = QUEUE_TIMEOUT;
-    queue.handler();
-    queue_reset();
+  for (uint8_t i = 0; i < QUEUE_SLOTS; i++) {
+    struct QueueSlot *s = queue.slot + i;
+    if (s->state == QUEUE_WAITING && s->order == queue.head &&
+        (millis() - s->timer) >= queue_requests[s->type].timeout) {
+      s->state = QUEUE_FREE;
+      queue_handler(s->type, QUEUE_TIMEOUT, NULL);
+      queue_advance(s->order + 1);
+    }
   }
+
+  // requests that came due since the last pass share a frame
+  queue_send();
 }
 
 #define BUTTON_PIN A3
@@ -601,12 +802,10 @@ void button_loop() {
       toggle_screen();
       break;
     case BUTTON2:
-      if (queue.stage == QUEUE_IDLE)
-        queue_start(post_handler);
+      queue_start(PROTOCOL_PST);
       break;
     case BUTTON3:
-      if (queue.stage == QUEUE_IDLE)
-        queue_start(updateUVI_handler);
+      queue_start(PROTOCOL_UVI);
       break;
     case BUTTON4:
       switch_screen();
@@ -616,39 +815,26 @@ void button_loop() {
   }
 }
 
-struct NTPResponse {
-  uint8_t year;
-  uint8_t month;
-  uint8_t weekday;
-  uint8_t day;
-  uint8_t hour;
-  uint8_t minute;
-  uint8_t second;
-  uint8_t error;
-};
-
-void updateNTPTime_handler() {
+void updateNTPTime_handler(uint8_t stage, struct ProtocolMessage *msg) {
 
-  switch (queue.stage) {
+  switch (stage) {
   case QUEUE_EXEC:
-    queue_execute(F("NTP\n"));
+    msg->length = 0;
     break;
   case QUEUE_ACT:
-    struct NTPResponse ntp;
-    if (static_cast<unsigned int>(ESP8266.available()) >=
-        sizeof(struct NTPResponse)) {
-      for (uint8_t i = 0; i < sizeof(struct NTPResponse); i++)
-        *((char *)&ntp + i) = ESP8266.read();
+    if (msg->length == sizeof(struct NTPResponse)) {
+      struct NTPResponse ntp;
+      memcpy(&ntp, msg + 1, sizeof(struct NTPResponse));
       ntp_error = ntp.error;
       if (ntp_error == 200) {
-        memcpy((char *)&DateTime, (char *)&ntp, 7);
+        memcpy((char *)&DateTime, (char *)&ntp.year, 7);
         PCF8563SetTime();
         log(Serial, F("Time synced"));
       } else
         log(Serial, F("Time not valid yet"));
-      queue_reset();
+      break;
     }
-    break;
+    // fall through
   case QUEUE_FAILED:
     ntp_error = 502;
     log(Serial, F("NTP handler got an unexpected response"));
@@ -659,38 +845,26 @@ void updateNTPTime_handler() {
   }
 }
 
-struct WFCResponse {
-  float temperature;
-  float dewpoint;
-  float windDirection;
-  float windSpeed;
-  float windGust;
-  float relativeHumidity;
-  int16_t error;
-  uint8_t padding[2];
-};
-
-void updateWeather_handler() {
+void updateWeather_handler(uint8_t stage, struct ProtocolMessage *msg) {
 
-  switch (queue.stage) {
+  switch (stage) {
   case QUEUE_EXEC:
-    queue_execute(F("WFC\n"));
+    msg->length = 0;
     break;
   case QUEUE_ACT:
-    struct WFCResponse wfc;
-    if (static_cast<unsigned int>(ESP8266.available()) >=
-        sizeof(struct WFCResponse)) {
-      for (uint8_t i = 0; i < sizeof(struct WFCResponse); i++)
-        *((char *)&wfc + i) = ESP8266.read();
+    if (msg->length == sizeof(struct WFCResponse)) {
+      struct WFCResponse wfc;
+      memcpy(&wfc, msg + 1, sizeof(struct WFCResponse));
       wfc_error = wfc.error;
       if (wfc.error == 200) {
-        memcpy((char *)&weather, (char *)&wfc, sizeof(struct WeatherFC));
+        memcpy((char *)&weather, (char *)&wfc.temperature,
+               sizeof(struct WeatherFC));
         log(Serial, F("Weather synced"));
       } else
         log(Serial, F("FC error %d"), wfc.error);
-      queue_reset();
+      break;
     }
-    break;
+    // fall through
   case QUEUE_FAILED:
     wfc_error = 502;
     log(Serial, F("Weather handler got an unexpected response"));
@@ -701,33 +875,25 @@ void updateWeather_handler() {
   }
 }
 
-struct UVIResponse {
-  uint16_t error;
-  uint8_t uv;
-  uint8_t padding;
-};
-
-void updateUVI_handler() {
+void updateUVI_handler(uint8_t stage, struct ProtocolMessage *msg) {
 
-  switch (queue.stage) {
+  switch (stage) {
   case QUEUE_EXEC:
-    queue_execute(F("UVI\n"));
+    msg->length = 0;
     break;
   case QUEUE_ACT:
-    struct UVIResponse uvi;
-    if (static_cast<unsigned int>(ESP8266.available()) >=
-        sizeof(struct UVIResponse)) {
-      for (uint8_t i = 0; i < sizeof(struct UVIResponse); i++)
-        *((char *)&uvi + i) = ESP8266.read();
+    if (msg->length == sizeof(struct UVIResponse)) {
+      struct UVIResponse uvi;
+      memcpy(&uvi, msg + 1, sizeof(struct UVIResponse));
       uv_error = uvi.error;
       if (uvi.error == 200) {
         uv = uvi.uv;
         log(Serial, F("UV synced"));
       } else
         log(Serial, F("UV error %d"), uvi.error);
-      queue_reset();
+      break;
     }
-    break;
+    // fall through
   case QUEUE_FAILED:
     uv_error = 502;
     log(Serial, F("UV handler got an unexpected response"));
@@ -738,44 +904,43 @@ void updateUVI_handler() {
   }
 }
 
-void post_handler() {
+void post_handler(uint8_t stage, struct ProtocolMessage *msg) {
 
   static const char *null_str = "null";
 
-  switch (queue.stage) {
-  case QUEUE_EXEC:
-    char cmd[192], photo_str[6];
+  switch (stage) {
+  case QUEUE_EXEC: {
+    char photo_str[6];
     kls_read(photo_str);
-    snprintf_P(cmd, sizeof(cmd),
-               PSTR("PST\n" POST_SERVER_ADDRESS "\n/"
-                    "sensors.php\n{\"timestamp\":\"20%02d-%02d-%02dT%02d:%02d:%"
-                    "02d\",\"temperature\":%s,\"humidity\":%s,\"pressure\":%s,"
-                    "\"photo\":%s,\"pm2_5\":%s, \"aqi2_5\":%s}\n"),
-               DateTime.year, DateTime.month, DateTime.day, DateTime.hour,
-               DateTime.minute, DateTime.second,
-               sv.temperature_str[0] ? sv.temperature_str : null_str,
-               sv.humidity_str[0] ? sv.humidity_str : null_str,
-               sv.pressure_str[0] ? sv.pressure_str : null_str,
-               photo_str[0] ? photo_str : null_str,
-               dsm501.pm2_5_str[0] ? dsm501.pm2_5_str : null_str,
-               dsm501.aqi2_5_str[0] ? dsm501.aqi2_5_str : null_str);
-
-    queue_execute(cmd);
-    break;
+    int n = snprintf_P(
+        (char *)(msg + 1), msg->length,
+        PSTR(POST_SERVER_ADDRESS
+             "\n/"
+             "sensors.php\n{\"timestamp\":\"20%02d-%02d-%02dT%02d:%02d:%"
+             "02d\",\"temperature\":%s,\"humidity\":%s,\"pressure\":%s,"
+             "\"photo\":%s,\"pm2_5\":%s, \"aqi2_5\":%s}"),
+        DateTime.year, DateTime.month, DateTime.day, DateTime.hour,
+        DateTime.minute, DateTime.second,
+        sv.temperature_str[0] ? sv.temperature_str : null_str,
+        sv.humidity_str[0] ? sv.humidity_str : null_str,
+        sv.pressure_str[0] ? sv.pressure_str : null_str,
+        photo_str[0] ? photo_str : null_str,
+        dsm501.pm2_5_str[0] ? dsm501.pm2_5_str : null_str,
+        dsm501.aqi2_5_str[0] ? dsm501.aqi2_5_str : null_str);
+    msg->length = min(n, PROTOCOL_REQUEST_MAX);
+  } break;
   case QUEUE_ACT:
-    if (ESP8266.available() >= 3) {
-      char code[4];
-      for (uint8_t i = 0; i < 3; i++)
-        code[i] = ESP8266.read();
-      code[3] = '\0';
-      post_error = atoi(code);
+    if (msg->length == sizeof(struct StatusResponse)) {
+      struct StatusResponse pst;
+      memcpy(&pst, msg + 1, sizeof(struct StatusResponse));
+      post_error = pst.error;
       if (post_error != 200)
         log(Serial, F("Post error %d"), post_error);
       else
         log(Serial, F("Sensors posted"));
-      queue_reset();
+      break;
     }
-    break;
+    // fall through
   case QUEUE_FAILED:
     post_error = 502;
     log(Serial, F("Post handler got an unexpected response"));
@@ -786,23 +951,23 @@ void post_handler() {
   }
 }
 
-void wifi_handler() {
+void wifi_handler(uint8_t stage, struct ProtocolMessage *msg) {
 
-  switch (queue.stage) {
+  switch (stage) {
   case QUEUE_EXEC:
-    queue_execute(F("WIF\n"));
+    msg->length = 0;
     break;
   case QUEUE_ACT:
-    if (ESP8266.available() >= 2) {
-      wifi_error = 0;
-      for (uint8_t i = 0; i < 2; i++)
-        wifi_error |= (ESP8266.read() << (i * 8));
+    if (msg->length == sizeof(struct StatusResponse)) {
+      struct StatusResponse wif;
+      memcpy(&wif, msg + 1, sizeof(struct StatusResponse));
+      wifi_error = wif.error;
       if (wifi_error != 200)
         log(Serial, F("WiFi error %d"), wifi_error);
       wifi_fail = 0;
-      queue_reset();
+      break;
     }
-    break;
+    // fall through
   case QUEUE_FAILED:
     wifi_error = 502;
     log(Serial, F("WiFi handler got an unexpected response"));
@@ -814,30 +979,27 @@ void wifi_handler() {
   }
 }
 
-void websiteFromURL_handler() {
+void websiteFromURL_handler(uint8_t stage, struct ProtocolMessage *msg) {
 
-  static uint8_t pck_len = 0;
-  switch (queue.stage) {
-  case QUEUE_EXEC:
-    queue_execute(F("URL\n" POST_SERVER_ADDRESS "\n"));
-    break;
-  case QUEUE_ACT: {
-    unsigned long timeout = millis();
-    while (ESP8266.available()) {
-      char c = ESP8266.read();
-      if (c == 0x04) {
-        pck_len = 0;
-        queue_reset();
-      }
-      if (++pck_len == 56) {
-        ESP8266.write(0x06);
-        pck_len = 0;
-      }
-      Serial.write(c);
-      if ((millis() - timeout) >= 200ul)
-        break;
-    }
+  switch (stage) {
+  case QUEUE_EXEC: {
+    int n = snprintf_P((char *)(msg + 1), msg->length,
+                       PSTR(POST_SERVER_ADDRESS));
+    msg->length = min(n, PROTOCOL_REQUEST_MAX);
   } break;
+  case QUEUE_ACT:
+    if (msg->length >= sizeof(struct StatusResponse)) {
+      struct StatusResponse url;
+      memcpy(&url, msg + 1, sizeof(struct StatusResponse));
+      Serial.write((uint8_t *)(msg + 1) + sizeof(struct StatusResponse),
+                   msg->length - sizeof(struct StatusResponse));
+      if (url.error == 206)
+        queue_continue(PROTOCOL_URL);
+      else if (url.error != 200)
+        log(Serial, F("URL error %d"), url.error);
+      break;
+    }
+    // fall through
   case QUEUE_FAILED:
     post_error = 502;
     log(Serial, F("URL handler got an unexpected response"));
@@ -848,6 +1010,29 @@ void websiteFromURL_handler() {
   }
 }
 
+void queue_handler(uint8_t type, uint8_t stage, struct ProtocolMessage *msg) {
+
+  switch (type) {
+  case PROTOCOL_NTP:
+    updateNTPTime_handler(stage, msg);
+    break;
+  case PROTOCOL_WIF:
+    wifi_handler(stage, msg);
+    break;
+  case PROTOCOL_WFC:
+    updateWeather_handler(stage, msg);
+    break;
+  case PROTOCOL_UVI:
+    updateUVI_handler(stage, msg);
+    break;
+  case PROTOCOL_PST:
+    post_handler(stage, msg);
+    break;
+  case PROTOCOL_URL:
+    websiteFromURL_handler(stage, msg);
+  }
+}
+
 void setup() {
 
   pinMode(ESP8266_RST_PIN, OUTPUT);
@@ -913,8 +1098,7 @@ void loop() {
 
   wifi_loop();
 
-  if (ESP8266.available())
-    queue.handler();
+  queue_read();
 
   queue_loop();
 
@@ -956,9 +1140,8 @@ void loop() {
 
   ms = millis();
   if ((ms - timers.NTP.timer) >= timers.NTP.delay) {
-    if (queue.stage == QUEUE_IDLE && wifi_error == 200) {
+    if (wifi_error == 200 && queue_start(PROTOCOL_NTP)) {
       timers.NTP.timer = ms;
-      queue_start(updateNTPTime_handler);
       if (timers.NTP.delay < timers.NTP.interval)
         timers.NTP.delay = timers.NTP.interval;
     }
@@ -966,9 +1149,8 @@ void loop() {
 
   ms = millis();
   if ((ms - timers.weather.timer) >= timers.weather.delay) {
-    if (queue.stage == QUEUE_IDLE && wifi_error == 200) {
+    if (wifi_error == 200 && queue_start(PROTOCOL_WFC)) {
       timers.weather.timer = ms;
-      queue_start(updateWeather_handler);
       if (timers.weather.delay < timers.weather.interval)
         timers.weather.delay = timers.weather.interval;
     }
@@ -976,9 +1158,8 @@ void loop() {
 
   ms = millis();
   if ((ms - timers.uv.timer) >= timers.uv.delay) {
-    if (queue.stage == QUEUE_IDLE && wifi_error == 200) {
+    if (wifi_error == 200 && queue_start(PROTOCOL_UVI)) {
       timers.uv.timer = ms;
-      queue_start(updateUVI_handler);
       if (timers.uv.delay < timers.uv.interval)
         timers.uv.delay = timers.uv.interval;
     }
@@ -1004,17 +1185,13 @@ void loop() {
 
   ms = millis();
   if ((ms - timers.post.timer) >= timers.post.delay) {
-    if (queue.stage == QUEUE_IDLE && wifi_error == 200) {
+    if (wifi_error == 200 && queue_start(PROTOCOL_PST))
       timers.post.timer = ms;
-      queue_start(post_handler);
-    }
   }
 
   ms = millis();
   if ((ms - timers.wifi.timer) >= timers.wifi.delay) {
-    if (queue.stage == QUEUE_IDLE && wifi_fail < WIFI_MAX_FAIL) {
+    if (wifi_fail < WIFI_MAX_FAIL && queue_start(PROTOCOL_WIF))
       timers.wifi.timer = ms;
-      queue_start(wifi_handler);
-    }
   }
 }
@@ -0,0 +1,180 @@
+/**
+ *  @file    Protocol.h
+ *  @brief   Sensor Pod Uno-ESP8266 Framed Protocol
+ *  @author  KrizTioaN (christiaanboersma@hotmail.com)
+ *  @date    2021-08-06
+ *  @note    BSD-3 licensed
+ *  @details Shared between the Uno and the ESP8266. A frame is a
+ *           ProtocolHeader, `length` bytes of payload, and a CRC-16/XMODEM
+ *           over everything after the sync bytes. The payload holds one or
+ *           more messages, each a ProtocolMessage followed by its body, so
+ *           several requests, or responses, share a frame. Responses carry
+ *           the sequence number of the frame that requested them. Bodies are
+ *           the packed structs below, little-endian as both ends are, and
+ *           PROTOCOL_VERSION is bumped whenever one of them changes. Bytes
+ *           outside frames are the ESP8266's log, which the Uno passes on.
+ *
+ ***********************************************/
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PROTOCOL_SYNC0 0xA5
+#define PROTOCOL_SYNC1 0x5A
+#define PROTOCOL_VERSION 1
+
+#define PROTOCOL_REQUEST_MAX 240 // payload bytes, Uno to ESP8266
+#define PROTOCOL_RESPONSE_MAX 64 // payload bytes, ESP8266 to Uno
+#define PROTOCOL_URL_CHUNK 56    // page bytes per URL response
+
+// message types, requests and responses alike
+#define PROTOCOL_NTP 1 // time, no body, NTPResponse
+#define PROTOCOL_WIF 2 // WiFi status, no body, StatusResponse
+#define PROTOCOL_WFC 3 // weather, no body, WFCResponse
+#define PROTOCOL_UVI 4 // UV index, no body, UVIResponse
+#define PROTOCOL_PST 5 // post, "host\npath\njson", StatusResponse
+#define PROTOCOL_URL 6 // page, "host" then empty to continue, see below
+#define PROTOCOL_TYPES 7
+
+struct __attribute__((packed)) ProtocolHeader {
+  uint8_t sync[2];
+  uint8_t version;
+  uint8_t seq;
+  uint8_t length; // of the payload
+};
+
+struct __attribute__((packed)) ProtocolMessage {
+  uint8_t type;
+  uint8_t length; // of the body that follows
+};
+
+// error holds an HTTP-like status code throughout
+struct __attribute__((packed)) StatusResponse {
+  uint16_t error;
+};
+
+struct __attribute__((packed)) NTPResponse {
+  uint16_t error;
+  uint8_t year; // since 2000
+  uint8_t month;
+  uint8_t weekday;
+  uint8_t day;
+  uint8_t hour;
+  uint8_t minute;
+  uint8_t second;
+};
+
+struct __attribute__((packed)) WFCResponse {
+  uint16_t error;
+  float temperature;
+  float dewpoint;
+  float windDirection;
+  float windSpeed;
+  float windGust;
+  float relativeHumidity;
+};
+
+struct __attribute__((packed)) UVIResponse {
+  uint16_t error;
+  uint8_t uv;
+};
+
+// a URL response is a StatusResponse followed by up to PROTOCOL_URL_CHUNK
+// bytes of the page; 206 means more follows once the Uno sends an empty URL
+// request, 200 that the page is complete, anything else that it failed
+
+static_assert(sizeof(struct ProtocolHeader) == 5, "header layout");
+static_assert(sizeof(struct NTPResponse) == 9, "NTPResponse layout");
+static_assert(sizeof(struct WFCResponse) == 26, "WFCResponse layout");
+static_assert(sizeof(struct UVIResponse) == 3, "UVIResponse layout");
+static_assert(sizeof(struct ProtocolMessage) + sizeof(struct StatusResponse) +
+                      PROTOCOL_URL_CHUNK <=
+                  PROTOCOL_RESPONSE_MAX,
+              "URL chunk does not fit a response");
+
+static inline uint16_t protocol_crc16(uint16_t crc, const uint8_t *data,
+                                      size_t len) {
+  while (len--) {
+    crc ^= (uint16_t)*data++ << 8;
+    for (uint8_t i = 0; i < 8; i++)
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+template <class Port>
+void protocol_write(Port &port, uint8_t seq, const uint8_t *payload,
+                    uint8_t len) {
+  struct ProtocolHeader hdr = {{PROTOCOL_SYNC0, PROTOCOL_SYNC1},
+                               PROTOCOL_VERSION, seq, len};
+  uint16_t crc = protocol_crc16(0, hdr.sync + 2, sizeof(hdr) - 2);
+  crc = protocol_crc16(crc, payload, len);
+  port.write((const uint8_t *)&hdr, sizeof(hdr));
+  port.write(payload, len);
+  port.write((uint8_t)(crc & 0xFF));
+  port.write((uint8_t)(crc >> 8));
+}
+
+// the message at offset pos of a payload, or NULL past its end
+static inline struct ProtocolMessage *
+protocol_message(uint8_t *payload, uint8_t len, uint8_t pos) {
+  if (pos + sizeof(struct ProtocolMessage) > len)
+    return NULL;
+  struct ProtocolMessage *msg = (struct ProtocolMessage *)(payload + pos);
+  return pos + sizeof(struct ProtocolMessage) + msg->length <= len ? msg
+                                                                   : NULL;
+}
+
+#define PROTOCOL_MORE 0  // byte taken, frame incomplete
+#define PROTOCOL_FRAME 1 // frame complete, header and payload valid
+#define PROTOCOL_OTHER 2 // byte is not part of a frame
+#define PROTOCOL_ERROR 3 // frame dropped: bad version, length, or CRC
+
+struct ProtocolReader {
+  uint8_t *payload;
+  uint8_t size; // of payload
+  struct ProtocolHeader hdr;
+  uint16_t pos; // bytes of the frame received so far
+  uint16_t crc;
+  uint8_t check; // low byte of the received CRC
+};
+
+// feeds a received byte to a reader
+static inline uint8_t protocol_read(struct ProtocolReader *r, uint8_t c) {
+  const uint16_t hlen = sizeof(struct ProtocolHeader);
+  if (r->pos < 2) {
+    if (c != (r->pos ? PROTOCOL_SYNC1 : PROTOCOL_SYNC0)) {
+      r->pos = c == PROTOCOL_SYNC0;
+      return r->pos ? PROTOCOL_MORE : PROTOCOL_OTHER;
+    }
+    r->hdr.sync[r->pos++] = c;
+    r->crc = 0;
+    return PROTOCOL_MORE;
+  }
+  if (r->pos < hlen) {
+    ((uint8_t *)&r->hdr)[r->pos++] = c;
+    r->crc = protocol_crc16(r->crc, &c, 1);
+    if (r->pos == hlen &&
+        (r->hdr.version != PROTOCOL_VERSION || r->hdr.length > r->size)) {
+      r->pos = 0;
+      return PROTOCOL_ERROR;
+    }
+    return PROTOCOL_MORE;
+  }
+  const uint16_t n = r->pos++ - hlen;
+  if (n < r->hdr.length) {
+    r->payload[n] = c;
+    r->crc = protocol_crc16(r->crc, &c, 1);
+  } else if (n == r->hdr.length)
+    r->check = c;
+  else {
+    r->pos = 0;
+    return (r->check | c << 8) == r->crc ? PROTOCOL_FRAME : PROTOCOL_ERROR;
+  }
+  return PROTOCOL_MORE;
+}
+
+#endif // PROTOCOL_H